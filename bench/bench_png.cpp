@@ -0,0 +1,306 @@
+#include "../include/picopng.hxx"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifndef BENCH_PNG_CORPUS
+#define BENCH_PNG_CORPUS "png_corpus"
+#endif
+#ifndef BENCH_PNG_BUILD_TYPE
+#define BENCH_PNG_BUILD_TYPE ""
+#endif
+
+// decodes every image of the corpus png_corpus writes and prints, as JSON,
+// the best time of each image in MB/s of RGBA output and the heap
+// allocations one decode makes. Three paths are measured: decodePNG on a PNG
+// already in memory, the same with a decoder and image reused from the decode
+// before, and what Engine::load_texture does, reading the file and decoding
+// it bottom up with checksums verified, to the channels of the PNG.
+// texture_bytes is what that uploads, against 4 bytes a pixel of RGBA.
+// With --inflate only the zlib stream of each image is timed, inflated from
+// its IDAT chunks into the scanline buffer, in MB/s of scanlines, which
+// leaves out unfiltering and conversion to see the inflate loop alone
+
+namespace
+{
+    // counts operator new, which every allocation of picopng goes through
+    unsigned long long allocation_count = 0;
+    unsigned long long allocation_bytes = 0;
+}
+
+void* operator new(std::size_t size)
+{
+    ++allocation_count;
+    allocation_bytes += size;
+    if (void* memory = std::malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+namespace
+{
+    struct measure
+    {
+        int error                      = 0;
+        double best_seconds            = 0;
+        unsigned long long allocations = 0;
+        unsigned long long bytes       = 0;
+    };
+
+    // runs decode up to repetitions times, less once two seconds are spent,
+    // the allocations are those of the first run
+    template <typename Decode>
+    measure run(int repetitions, Decode decode)
+    {
+        using clock = std::chrono::steady_clock;
+        measure m;
+        double spent = 0;
+        for (int i = 0; i < repetitions && spent < 2.0; ++i)
+        {
+            unsigned long long count = allocation_count;
+            unsigned long long bytes = allocation_bytes;
+            clock::time_point start  = clock::now();
+            m.error                  = decode();
+            double seconds =
+                std::chrono::duration<double>(clock::now() - start).count();
+            if (i == 0)
+            {
+                m.allocations  = allocation_count - count;
+                m.bytes        = allocation_bytes - bytes;
+                m.best_seconds = seconds;
+            }
+            m.best_seconds = std::min(m.best_seconds, seconds);
+            spent += seconds;
+            if (m.error != 0)
+                break;
+        }
+        return m;
+    }
+
+    // bytes of the filtered scanlines of an image, each with its filter
+    // byte, those of the 7 passes for Adam7
+    size_t scanline_bytes(const picopng::Probe& probe)
+    {
+        static const unsigned long start_x[7] = { 0, 4, 0, 2, 0, 1, 0 };
+        static const unsigned long start_y[7] = { 0, 0, 4, 0, 2, 0, 1 };
+        static const unsigned long step_x[7]  = { 8, 8, 4, 4, 2, 2, 1 };
+        static const unsigned long step_y[7]  = { 8, 8, 8, 4, 4, 2, 2 };
+        static const unsigned long samples[7] = { 1, 0, 3, 1, 2, 0, 4 };
+        const unsigned long bits = probe.bitDepth * samples[probe.colorType];
+        if (probe.interlaceMethod == 0)
+            return probe.height * (1 + (probe.width * bits + 7) / 8);
+        size_t bytes = 0;
+        for (int pass = 0; pass < 7; ++pass)
+        {
+            const unsigned long width =
+                (probe.width + step_x[pass] - 1 - start_x[pass]) / step_x[pass];
+            const unsigned long height =
+                (probe.height + step_y[pass] - 1 - start_y[pass]) /
+                step_y[pass];
+            if (probe.width > start_x[pass] && probe.height > start_y[pass])
+                bytes += height * (1 + (width * bits + 7) / 8);
+        }
+        return bytes;
+    }
+
+    // the data of the IDAT chunks of a PNG, where they are in it
+    std::vector<std::pair<const unsigned char*, size_t>>
+    idat_chunks(const std::vector<unsigned char>& png)
+    {
+        std::vector<std::pair<const unsigned char*, size_t>> chunks;
+        for (size_t pos = 8; pos + 12 <= png.size();)
+        {
+            const size_t length = size_t(png[pos]) << 24 |
+                                  size_t(png[pos + 1]) << 16 |
+                                  size_t(png[pos + 2]) << 8 | png[pos + 3];
+            if (length > png.size() - pos - 12)
+                break;
+            if (std::equal(&png[pos + 4], &png[pos + 8], "IDAT"))
+                chunks.emplace_back(&png[pos + 8], length);
+            pos += length + 12;
+        }
+        return chunks;
+    }
+
+    void print(const char* name, const measure& m, size_t image_bytes)
+    {
+        std::cout << "\"" << name << "\": { ";
+        if (m.error != 0)
+        {
+            std::cout << "\"error\": " << m.error << " }";
+            return;
+        }
+        std::cout << "\"ms\": " << m.best_seconds * 1e3
+                  << ", \"mb_per_s\": " << image_bytes / m.best_seconds / 1e6
+                  << ", \"allocations\": " << m.allocations
+                  << ", \"allocated_bytes\": " << m.bytes << " }";
+    }
+
+    // the --inflate mode, the inflate loop alone on every image
+    bool bench_inflate(std::istream& list,
+                       const std::string& dir,
+                       int repetitions)
+    {
+        bool failed = false;
+        picopng::Zlib::ChunkInflator zlib;
+        std::string name;
+        for (int n = 0; std::getline(list, name); ++n)
+        {
+            std::vector<unsigned char> png;
+            loadFile(png, dir + "/" + name);
+            picopng::Probe probe;
+            const int error =
+                png.empty() ? 30 : probePNG(&png.front(), png.size(), probe);
+            const std::vector<std::pair<const unsigned char*, size_t>> chunks =
+                idat_chunks(png);
+            const size_t bytes = error == 0 ? scanline_bytes(probe) : 0;
+            std::vector<unsigned char> scanlines(bytes);
+
+            measure inflate;
+            inflate.error = error;
+            if (error == 0)
+            {
+                inflate = run(repetitions, [&] {
+                    zlib.init(scanlines.empty() ? nullptr : &scanlines.front(),
+                              scanlines.size());
+                    for (const auto& chunk : chunks)
+                        zlib.feed(chunk.first, chunk.second);
+                    zlib.finish();
+                    // a stream of another size than the scanlines is broken
+                    return zlib.error != 0 ? zlib.error
+                                           : zlib.pos != bytes ? 91 : 0;
+                });
+            }
+            failed = failed || inflate.error != 0;
+
+            std::cout << (n ? "," : "") << "\n    { \"name\": \"" << name
+                      << "\", \"scanline_bytes\": " << bytes
+                      << ", \"idat_chunks\": " << chunks.size() << ", ";
+            print("inflate", inflate, bytes);
+            std::cout << " }";
+        }
+        return !failed;
+    }
+}
+
+int main(int argn, char* args[])
+{
+    const bool inflate_only = argn > 1 && std::string(args[1]) == "--inflate";
+    if (inflate_only)
+    {
+        --argn;
+        ++args;
+    }
+    const std::string dir = argn > 1 ? args[1] : BENCH_PNG_CORPUS;
+    const int repetitions = argn > 2 ? std::atoi(args[2]) : 5;
+    if (repetitions < 1)
+    {
+        std::cerr << "usage: bench_png [--inflate] [corpus directory] "
+                     "[repetitions]"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::ifstream list(dir + "/corpus.txt");
+    if (!list.is_open())
+    {
+        std::cerr << "Can't open " << dir << "/corpus.txt" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    bool failed = false;
+    std::cout << "{\n  \"build_type\": \"" << BENCH_PNG_BUILD_TYPE
+              << "\",\n  \"repetitions\": " << repetitions
+              << ",\n  \"images\": [";
+    if (inflate_only)
+    {
+        failed = !bench_inflate(list, dir, repetitions);
+        std::cout << "\n  ]\n}" << std::endl;
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    // the decoder of the thread Engine::decode_texture runs on, kept from
+    // image to image
+    picopng::PNG texture_decoder;
+    std::string name;
+    for (int n = 0; std::getline(list, name); ++n)
+    {
+        const std::string path = dir + "/" + name;
+        std::vector<unsigned char> png;
+        loadFile(png, path);
+
+        std::vector<unsigned char> image;
+        unsigned long width = 0, height = 0;
+        unsigned int channels = 4;
+        measure in_memory = run(repetitions, [&] {
+            std::vector<unsigned char>().swap(image);
+            return decodePNG(image,
+                             width,
+                             height,
+                             png.empty() ? nullptr : &png.front(),
+                             png.size());
+        });
+
+        // warmed up once, so the allocations are those of every decode after
+        picopng::PNG decoder;
+        std::vector<unsigned char> reused_image;
+        auto decode_reused = [&] {
+            return decodePNG(decoder,
+                             reused_image,
+                             width,
+                             height,
+                             png.empty() ? nullptr : &png.front(),
+                             png.size());
+        };
+        decode_reused();
+        measure reused = run(repetitions, decode_reused);
+
+        // the same steps and flags as Engine::decode_texture
+        measure load_texture = run(repetitions, [&] {
+            std::vector<unsigned char> buffer;
+            loadFile(buffer, path);
+            std::vector<unsigned char>().swap(image);
+            bool bottom_up        = true;
+            bool verify_checksums = true;
+            int error             = decodePNGChannels(texture_decoder,
+                                          image,
+                                          width,
+                                          height,
+                                          channels,
+                                          buffer.empty() ? nullptr
+                                                         : &buffer.front(),
+                                          buffer.size(),
+                                          bottom_up,
+                                          verify_checksums);
+            texture_decoder.releaseScratch(4 * 1024 * 1024);
+            return error;
+        });
+        failed = failed || in_memory.error != 0 || reused.error != 0 ||
+                 load_texture.error != 0;
+
+        const size_t image_bytes = 4 * width * height;
+        std::cout << (n ? "," : "") << "\n    { \"name\": \"" << name
+                  << "\", \"width\": " << width << ", \"height\": " << height
+                  << ", \"file_bytes\": " << png.size()
+                  << ", \"image_bytes\": " << image_bytes
+                  << ", \"texture_bytes\": " << channels * width * height
+                  << ",\n      ";
+        print("decodePNG", in_memory, image_bytes);
+        std::cout << ",\n      ";
+        print("decodePNG_reused", reused, image_bytes);
+        std::cout << ",\n      ";
+        print("load_texture", load_texture, image_bytes);
+        std::cout << " }";
+    }
+    std::cout << "\n  ]\n}" << std::endl;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
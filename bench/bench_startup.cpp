@@ -0,0 +1,146 @@
+#include "../include/engine.hpp"
+#include "../include/engine_constants.hpp"
+#include "../tools/texture_baker.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifndef BENCH_PNG_CORPUS
+#define BENCH_PNG_CORPUS "png_corpus"
+#endif
+
+// loads the textures of the corpus png_corpus writes with load_textures, as
+// a game starts, once from the PNGs and once from baked copies of them, and
+// prints as JSON the time of each, cold, with the files dropped from the
+// page cache first, and warm, the best of a few loads right after. The
+// copies are baked into baked/ of the corpus on the first run, texels
+// without mipmaps as the PNGs are loaded. Runs in a window, from the
+// directory the shaders are found from, like the game
+namespace
+{
+    struct startup_times
+    {
+        double cold_ms                = 0;
+        double warm_ms                = 0;
+        unsigned long long file_bytes = 0;
+    };
+
+    // asks the kernel to forget the cached pages of a file, where it can
+    bool drop_cached(const std::string& path)
+    {
+#if defined(POSIX_FADV_DONTNEED)
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        fdatasync(fd);
+        const bool dropped =
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+        close(fd);
+        return dropped;
+#else
+        static_cast<void>(path);
+        return false;
+#endif
+    }
+
+    double load_ms(ge::IEngine& engine, const std::vector<std::string>& paths)
+    {
+        using clock                   = std::chrono::steady_clock;
+        const clock::time_point start = clock::now();
+        std::vector<ge::texture_handle> handles = engine.load_textures(paths);
+        const std::chrono::duration<double, std::milli> spent =
+            clock::now() - start;
+        // so the next load reads the files again
+        for (ge::texture_handle handle : handles)
+            engine.release_texture(handle);
+        return spent.count();
+    }
+
+    startup_times measure(ge::IEngine& engine,
+                          const std::vector<std::string>& paths,
+                          bool& cold)
+    {
+        startup_times times;
+        for (const std::string& path : paths)
+        {
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            times.file_bytes += static_cast<unsigned long long>(file.tellg());
+            cold = drop_cached(path) && cold;
+        }
+        times.cold_ms = load_ms(engine, paths);
+        times.warm_ms = load_ms(engine, paths);
+        for (int i = 0; i < 2; ++i)
+            times.warm_ms = std::min(times.warm_ms, load_ms(engine, paths));
+        return times;
+    }
+
+    void print(const char* name, const startup_times& times)
+    {
+        std::cout << "\"" << name << "\": { \"file_bytes\": "
+                  << times.file_bytes << ", \"cold_ms\": " << times.cold_ms
+                  << ", \"warm_ms\": " << times.warm_ms << " }";
+    }
+
+    int run(ge::IEngine& engine, const std::string& dir)
+    {
+        std::ifstream list(dir + "/corpus.txt");
+        if (!list.is_open())
+        {
+            std::cerr << "Can't open " << dir << "/corpus.txt" << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::vector<std::string> pngs, baked;
+        ge::bake_options opts;
+        opts.mipmaps = ge::mip_filter::none;
+        for (std::string name; std::getline(list, name);)
+        {
+            pngs.push_back(dir + "/" + name);
+            baked.push_back(dir + "/baked/" +
+                            name.substr(0, name.find_last_of('.')) + ".btex");
+            if (!std::ifstream(baked.back()).is_open() &&
+                !ge::bake_texture(pngs.back(), baked.back(), opts))
+            {
+                std::cerr << "Can't bake the corpus into " << dir << "/baked"
+                          << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        bool cold                = true;
+        startup_times from_png   = measure(engine, pngs, cold);
+        startup_times from_baked = measure(engine, baked, cold);
+
+        std::cout << "{\n  \"textures\": " << pngs.size()
+                  << ",\n  \"cold\": " << (cold ? "true" : "false")
+                  << ",\n  ";
+        print("png", from_png);
+        std::cout << ",\n  ";
+        print("baked", from_baked);
+        std::cout << "\n}" << std::endl;
+        return EXIT_SUCCESS;
+    }
+}
+
+int main(int argn, char* args[])
+{
+    const std::string dir = argn > 1 ? args[1] : BENCH_PNG_CORPUS;
+
+    ge::IEngine* engine = ge::getInstance();
+    std::string error   = engine->init_engine(ge::everything);
+    if (!error.empty())
+    {
+        std::cerr << error << std::endl;
+        return EXIT_FAILURE;
+    }
+    int result = run(*engine, dir);
+    engine->uninit_engine();
+    return result;
+}
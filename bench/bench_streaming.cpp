@@ -0,0 +1,204 @@
+#include "../include/engine.hpp"
+#include "../include/engine_constants.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef BENCH_PNG_CORPUS
+#define BENCH_PNG_CORPUS "png_corpus"
+#endif
+
+// draws frames while the textures of the corpus png_corpus writes, about
+// 500 MB of them, are loaded, and prints as JSON the frame times of each
+// way of loading them: load_texture on the render thread, one a frame, and
+// load_texture_async with no upload budget and with the given one, and what
+// swap_buffers spent on the uploads, in MB/s and ms blocked. Frames
+// are paced to 60 a second, as vsync would, and one is counted as a spike
+// when it misses its frame. Runs in a window, from the directory the shaders
+// are found from, like the game
+namespace
+{
+    const double frame_ms = 1000.0 / 60;
+
+    struct frame_times
+    {
+        std::vector<double> ms; // from swap to swap
+        double seconds = 0; // until every texture was ready
+        ge::texture_upload_stats uploads; // of swap_buffers while loading
+    };
+
+    template <typename Load>
+    frame_times stream(ge::IEngine& engine,
+                       const std::vector<std::string>& paths,
+                       Load load)
+    {
+        using clock = std::chrono::steady_clock;
+        // half the window, showing the newest texture
+        ge::texture triangle;
+        const float corners[3][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 } };
+        for (int i = 0; i < 3; ++i)
+        {
+            triangle.coords[i].x     = corners[i][0];
+            triangle.coords[i].y     = corners[i][1];
+            triangle.tex_coords[i].x = (corners[i][0] + 1) / 2;
+            triangle.tex_coords[i].y = (corners[i][1] + 1) / 2;
+        }
+
+        std::vector<ge::texture_handle> handles;
+        ge::texture_handle drawn = 0;
+        frame_times times;
+        const ge::texture_upload_stats before =
+            engine.get_texture_upload_stats();
+        const std::chrono::duration<double, std::milli> period(frame_ms);
+        const clock::time_point start = clock::now();
+        clock::time_point frame       = start;
+        clock::time_point deadline    = start;
+        for (bool ready = false; !ready;)
+        {
+            load(handles);
+            ready = handles.size() == paths.size();
+            for (ge::texture_handle handle : handles)
+                ready = ready && engine.texture_ready(handle);
+
+            // bound once, as the game binds its texture, swap_buffers keeps
+            // it bound while it uploads the others
+            if (!handles.empty() && handles.back() != drawn)
+            {
+                drawn = handles.back();
+                engine.draw_texture(drawn);
+            }
+            engine.render(triangle);
+            engine.swap_buffers();
+
+            // the next frame is due a period after this one was, or after
+            // now for a frame that missed it
+            deadline += std::chrono::duration_cast<clock::duration>(period);
+            if (deadline < clock::now())
+                deadline = clock::now();
+            std::this_thread::sleep_until(deadline);
+
+            const clock::time_point now = clock::now();
+            times.ms.push_back(
+                std::chrono::duration<double, std::milli>(now - frame)
+                    .count());
+            frame = now;
+        }
+        times.seconds = std::chrono::duration<double>(frame - start).count();
+        times.uploads = engine.get_texture_upload_stats();
+        times.uploads.bytes -= before.bytes;
+        times.uploads.upload_ms -= before.upload_ms;
+        times.uploads.blocked_ms -= before.blocked_ms;
+
+        // so the next way loads them again
+        for (ge::texture_handle handle : handles)
+            engine.release_texture(handle);
+        return times;
+    }
+
+    void print(const char* name, frame_times times)
+    {
+        std::vector<double>& ms = times.ms;
+        std::sort(ms.begin(), ms.end());
+        double sum    = 0;
+        size_t spikes = 0;
+        for (double t : ms)
+        {
+            sum += t;
+            spikes += t > 1.5 * frame_ms;
+        }
+        std::cout << "\"" << name << "\": { \"frames\": " << ms.size()
+                  << ", \"seconds\": " << times.seconds
+                  << ", \"mean_ms\": " << sum / ms.size()
+                  << ", \"median_ms\": " << ms[ms.size() / 2]
+                  << ", \"p99_ms\": " << ms[ms.size() * 99 / 100]
+                  << ", \"max_ms\": " << ms.back()
+                  << ", \"spikes\": " << spikes;
+        const ge::texture_upload_stats& uploads = times.uploads;
+        if (uploads.bytes != 0)
+        {
+            std::cout << ", \"upload_mb_per_s\": "
+                      << uploads.bytes / uploads.upload_ms / 1e3
+                      << ", \"upload_ms\": " << uploads.upload_ms
+                      << ", \"blocked_ms\": " << uploads.blocked_ms
+                      << ", \"pixel_buffers\": "
+                      << (uploads.pixel_buffers ? "true" : "false");
+        }
+        std::cout << " }";
+    }
+
+    int run(ge::IEngine& engine,
+            const std::string& dir,
+            size_t budget_bytes,
+            float budget_ms)
+    {
+        std::ifstream list(dir + "/corpus.txt");
+        if (!list.is_open())
+        {
+            std::cerr << "Can't open " << dir << "/corpus.txt" << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::vector<std::string> paths;
+        for (std::string name; std::getline(list, name);)
+            paths.push_back(dir + "/" + name);
+
+        frame_times sync = stream(engine, paths, [&](
+            std::vector<ge::texture_handle>& handles) {
+            if (handles.size() < paths.size())
+                handles.push_back(engine.load_texture(paths[handles.size()]));
+        });
+
+        auto load_all = [&](std::vector<ge::texture_handle>& handles) {
+            for (size_t i = handles.size(); i < paths.size(); ++i)
+                handles.push_back(engine.load_texture_async(paths[i]));
+        };
+        engine.set_upload_budget(0, 0.f);
+        frame_times unlimited = stream(engine, paths, load_all);
+        engine.set_upload_budget(budget_bytes, budget_ms);
+        frame_times budget = stream(engine, paths, load_all);
+        engine.set_upload_budget(0, 0.f);
+
+        std::cout << "{\n  \"textures\": " << paths.size()
+                  << ",\n  \"budget_bytes\": " << budget_bytes
+                  << ",\n  \"budget_ms\": " << budget_ms << ",\n  ";
+        print("load_texture", sync);
+        std::cout << ",\n  ";
+        print("load_texture_async", unlimited);
+        std::cout << ",\n  ";
+        print("load_texture_async_budget", budget);
+        std::cout << "\n}" << std::endl;
+        return EXIT_SUCCESS;
+    }
+}
+
+int main(int argn, char* args[])
+{
+    const std::string dir = argn > 1 ? args[1] : BENCH_PNG_CORPUS;
+    const double budget_mb = argn > 2 ? std::atof(args[2]) : 8;
+    const float budget_ms  = argn > 3 ? std::atof(args[3]) : 2.f;
+    if (budget_mb < 0 || budget_ms < 0)
+    {
+        std::cerr << "usage: bench_streaming [corpus directory] "
+                     "[budget MB a frame] [budget ms a frame]"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    ge::IEngine* engine = ge::getInstance();
+    std::string error   = engine->init_engine(ge::everything);
+    if (!error.empty())
+    {
+        std::cerr << error << std::endl;
+        return EXIT_FAILURE;
+    }
+    int result = run(*engine,
+                     dir,
+                     static_cast<size_t>(budget_mb * 1024 * 1024),
+                     budget_ms);
+    engine->uninit_engine();
+    return result;
+}
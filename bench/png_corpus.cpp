@@ -0,0 +1,209 @@
+#include "../tools/png_encoder.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// writes the images bench_png decodes, the same ones on every run: every
+// color type and bit depth, plain and Adam7, each kind of deflate block and
+// sizes from 16x16 up to 8192x8192. corpus.txt lists them and is written
+// last, so an interrupted run is started over by the build
+namespace
+{
+    struct corpus_image
+    {
+        unsigned int color_type;
+        unsigned int bit_depth;
+        unsigned long width;
+        unsigned long height;
+        bool interlaced;
+        ge::deflate_blocks blocks;
+    };
+
+    unsigned int hash(unsigned int x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    // 16-bit sample of channel c, made of 32x32 tiles that are smooth
+    // gradients, flat, noise or stripes, so that filters, literals and
+    // matches all get their share
+    unsigned int sample(unsigned long x, unsigned long y, unsigned int c)
+    {
+        unsigned int tile = hash(static_cast<unsigned int>(
+            (y / 32) * 65599 + x / 32 + 1));
+        switch (tile % 4)
+        {
+            case 0:
+                return ((x * (c + 1) * 509 + y * 257 * (4 - c)) & 0xffff);
+            case 1:
+                return (tile >> (c * 4)) * 0x1111 & 0xffff;
+            case 2:
+                return hash(static_cast<unsigned int>(
+                           (y * 8192 + x) * 4 + c)) &
+                       0xffff;
+            default:
+                return ((x + y) / 4 % 2 ? 0xffff : 0x1000 * c);
+        }
+    }
+
+    const char* color_name(unsigned int color_type)
+    {
+        static const char* names[7] = { "grey", "",           "rgb", "palette",
+                                        "grey_alpha", "", "rgba" };
+        return names[color_type];
+    }
+
+    std::string file_name(const corpus_image& image)
+    {
+        static const char* blocks[3] = { "stored", "fixed", "dynamic" };
+        std::ostringstream name;
+        name << color_name(image.color_type) << image.bit_depth << '_'
+             << image.width << 'x' << image.height
+             << (image.interlaced ? "_adam7_" : "_")
+             << blocks[static_cast<int>(image.blocks)] << ".png";
+        return name.str();
+    }
+
+    std::vector<unsigned char> encode(const corpus_image& image)
+    {
+        ge::png_info info;
+        info.width      = image.width;
+        info.height     = image.height;
+        info.color_type = image.color_type;
+        info.bit_depth  = image.bit_depth;
+        info.interlaced = image.interlaced;
+
+        const unsigned int depth    = image.bit_depth;
+        const unsigned int channels =
+            ge::png_encoder::bits_per_pixel(image.color_type, depth) / depth;
+        if (image.color_type == 3)
+        {
+            // palette of every index, with alpha so tRNS is exercised too
+            for (unsigned int i = 0; i < (1u << depth); ++i)
+            {
+                unsigned int rgba = hash(i + 7);
+                for (int c = 0; c < 3; ++c)
+                    info.palette.push_back((rgba >> (c * 8)) & 255);
+                info.transparency.push_back(rgba >> 24);
+            }
+        }
+
+        const size_t stride = ge::png_encoder::row_bytes(
+            image.width, image.color_type, depth);
+        std::vector<unsigned char> samples(stride * image.height);
+        for (unsigned long y = 0; y < image.height; ++y)
+        {
+            unsigned char* row = &samples[y * stride];
+            size_t bit         = 0;
+            for (unsigned long x = 0; x < image.width; ++x)
+            {
+                for (unsigned int c = 0; c < channels; ++c, bit += depth)
+                {
+                    unsigned int value = sample(x, y, c) >> (16 - depth);
+                    if (depth == 16)
+                    {
+                        row[bit / 8]     = value >> 8;
+                        row[bit / 8 + 1] = value & 255;
+                    }
+                    else
+                    {
+                        row[bit / 8] |= value << (8 - depth - bit % 8);
+                    }
+                }
+            }
+        }
+        return ge::png_encoder::encode(samples, info, image.blocks);
+    }
+
+    std::vector<corpus_image> corpus()
+    {
+        using ge::deflate_blocks;
+        std::vector<corpus_image> images;
+
+        // every color type and bit depth allowed, plain and Adam7
+        static const unsigned int formats[15][2] = {
+            { 0, 1 }, { 0, 2 }, { 0, 4 }, { 0, 8 }, { 0, 16 },
+            { 2, 8 }, { 2, 16 }, { 3, 1 }, { 3, 2 }, { 3, 4 },
+            { 3, 8 }, { 4, 8 }, { 4, 16 }, { 6, 8 }, { 6, 16 }
+        };
+        for (const auto& f : formats)
+        {
+            for (bool interlaced : { false, true })
+            {
+                images.push_back(corpus_image{ f[0],
+                                               f[1],
+                                               256,
+                                               256,
+                                               interlaced,
+                                               deflate_blocks::dynamic });
+            }
+        }
+
+        // each kind of deflate block, widths that are not a multiple of the
+        // pixels per byte or of the Adam7 step
+        for (deflate_blocks blocks : { deflate_blocks::stored,
+                                       deflate_blocks::fixed,
+                                       deflate_blocks::dynamic })
+        {
+            images.push_back(corpus_image{ 6, 8, 1024, 1024, false, blocks });
+            images.push_back(corpus_image{ 0, 8, 1024, 1024, false, blocks });
+            images.push_back(corpus_image{ 3, 8, 1024, 1024, false, blocks });
+            images.push_back(corpus_image{ 0, 1, 1021, 765, true, blocks });
+        }
+
+        // sizes from a small sprite to the largest texture
+        for (unsigned long size : { 16, 64, 256, 1024, 4096, 8192 })
+        {
+            images.push_back(corpus_image{
+                6, 8, size, size, false, deflate_blocks::dynamic });
+        }
+        images.push_back(
+            corpus_image{ 2, 8, 4096, 4096, false, deflate_blocks::dynamic });
+        images.push_back(
+            corpus_image{ 3, 4, 4096, 4096, false, deflate_blocks::dynamic });
+        return images;
+    }
+}
+
+int main(int argn, char* args[])
+{
+    if (argn != 2)
+    {
+        std::cerr << "usage: png_corpus <output directory>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string dir = args[1];
+
+    std::ostringstream list;
+    std::vector<std::string> written;
+    for (const corpus_image& image : corpus())
+    {
+        const std::string name = file_name(image);
+        if (std::find(written.begin(), written.end(), name) != written.end())
+            continue;
+        written.push_back(name);
+
+        std::vector<unsigned char> png = encode(image);
+        std::ofstream file(dir + "/" + name, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&png.front()), png.size());
+        if (!file.good())
+        {
+            std::cerr << "Can't write " << dir << "/" << name << std::endl;
+            return EXIT_FAILURE;
+        }
+        list << name << '\n';
+    }
+
+    std::ofstream file(dir + "/corpus.txt");
+    file << list.str();
+    return file.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,7 +1,17 @@
 varying vec2 v_tex_coord;
 uniform sampler2D s_texture;
+// 1 if s_texture is R8 grey, 2 if RG8 grey and alpha, 0 if sampled as is,
+// -1 while it is streamed in and drawn as a transparent placeholder
+uniform int s_channels;
 
 void main()
 {
-    gl_FragColor = texture2D(s_texture, v_tex_coord);
+    vec4 texel = texture2D(s_texture, v_tex_coord);
+    if (s_channels == 1)
+        texel = vec4(texel.rrr, 1.0);
+    else if (s_channels == 2)
+        texel = texel.rrrg;
+    else if (s_channels < 0)
+        texel = vec4(0.0);
+    gl_FragColor = texel;
 }
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "block_compression.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+/*
+Baked textures, as tools/texture_baker writes them and Engine::load_texture
+maps them: the texels or blocks of every level of a mipmap chain, bottom row
+first as GL takes them, so a load is a mapping of the file and uploads
+straight from it, with nothing to decode.
+
+A file is a header of 32 bytes, a table of the levels, the offset and size of
+each in 16 bytes, and the levels, each at an offset that is a multiple of
+4096, the first byte of a page of the mapping. Numbers are little endian:
+
+    "BTEX", version, format, width, height, levels, 8 bytes of 0
+*/
+
+namespace ge
+{
+    enum class baked_format
+    {
+        r8 = 1, // texels of 1 to 4 channels
+        rg8,
+        rgb8,
+        rgba8,
+        bc1, // BC1 or BC3 blocks, see block_compression.hpp
+        bc3
+    };
+
+    struct baked_level
+    {
+        unsigned long long offset = 0; // from the start of the file
+        unsigned long long bytes  = 0;
+    };
+
+    struct baked_info
+    {
+        unsigned long width  = 0;
+        unsigned long height = 0;
+        baked_format format  = baked_format::rgba8;
+        std::vector<baked_level> levels;
+    };
+
+    const unsigned long baked_version = 1;
+    const size_t baked_header_bytes   = 32;
+    const size_t baked_level_bytes    = 16;
+    const size_t baked_alignment      = 4096;
+
+    namespace baked
+    {
+        inline unsigned long long get64(const unsigned char* p)
+        {
+            return dds::get32(p) |
+                   (static_cast<unsigned long long>(dds::get32(p + 4)) << 32);
+        }
+
+        inline void put64(unsigned char* p, unsigned long long value)
+        {
+            dds::put32(p, static_cast<unsigned long>(value & 0xffffffff));
+            dds::put32(p + 4, static_cast<unsigned long>(value >> 32));
+        }
+
+        inline unsigned long long align(unsigned long long offset)
+        {
+            return (offset + baked_alignment - 1) / baked_alignment *
+                   baked_alignment;
+        }
+    }
+
+    // channels of the texels of format, 0 for blocks
+    inline unsigned int baked_channels(baked_format format)
+    {
+        return format <= baked_format::rgba8 ? static_cast<unsigned int>(format)
+                                             : 0;
+    }
+
+    // bytes of a level of width x height
+    inline size_t baked_size(unsigned long width,
+                             unsigned long height,
+                             baked_format  format)
+    {
+        if (format == baked_format::bc1)
+            return blocks_size(width, height, block_format::bc1);
+        if (format == baked_format::bc3)
+            return blocks_size(width, height, block_format::bc3);
+        return size_t(width) * height * baked_channels(format);
+    }
+
+    // info with the levels laid out after the header and the table, of
+    // level sizes halved down from width x height
+    inline baked_info baked_layout(unsigned long width,
+                                   unsigned long height,
+                                   baked_format  format,
+                                   unsigned int  levels)
+    {
+        baked_info info;
+        info.width  = width;
+        info.height = height;
+        info.format = format;
+        info.levels.resize(levels);
+        unsigned long long offset =
+            baked_header_bytes + levels * baked_level_bytes;
+        for (unsigned int l = 0; l < levels; ++l)
+        {
+            const unsigned long w = width >> l, h = height >> l;
+            info.levels[l].offset = baked::align(offset);
+            info.levels[l].bytes  = baked_size(w ? w : 1, h ? h : 1, format);
+            offset = info.levels[l].offset + info.levels[l].bytes;
+        }
+        return info;
+    }
+
+    // the header and the table, the first level follows at its offset
+    inline std::vector<unsigned char> baked_header(const baked_info& info)
+    {
+        std::vector<unsigned char> header(
+            baked_header_bytes + info.levels.size() * baked_level_bytes, 0);
+        unsigned char* h = &header.front();
+        std::memcpy(h, "BTEX", 4);
+        dds::put32(h + 4, baked_version);
+        dds::put32(h + 8, static_cast<unsigned long>(info.format));
+        dds::put32(h + 12, info.width);
+        dds::put32(h + 16, info.height);
+        dds::put32(h + 20, static_cast<unsigned long>(info.levels.size()));
+        for (size_t l = 0; l < info.levels.size(); ++l)
+        {
+            unsigned char* level =
+                h + baked_header_bytes + l * baked_level_bytes;
+            baked::put64(level, info.levels[l].offset);
+            baked::put64(level + 8, info.levels[l].bytes);
+        }
+        return header;
+    }
+
+    // the header of a baked file of size bytes, false for any other file,
+    // and for one whose levels are not where baked_layout puts them
+    inline bool read_baked_header(const unsigned char* data,
+                                  size_t               size,
+                                  baked_info&          info)
+    {
+        if (size < baked_header_bytes || std::memcmp(data, "BTEX", 4) != 0 ||
+            dds::get32(data + 4) != baked_version)
+            return false;
+        const unsigned long format = dds::get32(data + 8);
+        const unsigned long width  = dds::get32(data + 12);
+        const unsigned long height = dds::get32(data + 16);
+        const unsigned long levels = dds::get32(data + 20);
+        if (format < static_cast<unsigned long>(baked_format::r8) ||
+            format > static_cast<unsigned long>(baked_format::bc3) ||
+            width == 0 || height == 0 || levels == 0 || levels > 32 ||
+            std::max(width, height) >> (levels - 1) == 0 ||
+            size < baked_header_bytes + levels * baked_level_bytes)
+            return false;
+
+        // the table is checked against the layout, a level can't point
+        // outside the file nor be of another size
+        info = baked_layout(width,
+                            height,
+                            static_cast<baked_format>(format),
+                            static_cast<unsigned int>(levels));
+        for (unsigned long l = 0; l < levels; ++l)
+        {
+            const unsigned char* level =
+                data + baked_header_bytes + l * baked_level_bytes;
+            if (baked::get64(level) != info.levels[l].offset ||
+                baked::get64(level + 8) != info.levels[l].bytes ||
+                info.levels[l].offset + info.levels[l].bytes > size)
+                return false;
+        }
+        return true;
+    }
+}
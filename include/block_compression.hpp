@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+/*
+BC1 and BC3 (DXT1 and DXT5) textures in DDS files, as tools/texture_compressor
+writes them and Engine::load_texture reads them, and the decoding of their
+blocks to RGBA for drivers without S3TC.
+
+A block holds 4x4 texels: BC1 in 8 bytes, two RGB565 colors and a 2 bit index
+of each texel into them and the two colors between; BC3 in 16, 8 bytes of
+alpha, two 8 bit values and a 3 bit index into them and six between, then the
+colors as BC1. Images whose sides are not multiples of 4 have their last
+blocks cut off. The mipmap chain follows level 0, down to 1x1.
+
+Rows of blocks are stored bottom first, the order GL and the other textures
+of the engine take them in, where other DDS readers expect the top first.
+*/
+
+namespace ge
+{
+    enum class block_format
+    {
+        bc1, // opaque RGB, 8 bytes a block
+        bc3  // RGBA, 16 bytes a block
+    };
+
+    inline size_t block_bytes(block_format format)
+    {
+        return format == block_format::bc1 ? 8 : 16;
+    }
+
+    // bytes of an image of width x height in blocks
+    inline size_t blocks_size(unsigned long width,
+                              unsigned long height,
+                              block_format  format)
+    {
+        return size_t((width + 3) / 4) * ((height + 3) / 4) *
+               block_bytes(format);
+    }
+
+    struct dds_info
+    {
+        unsigned long width  = 0;
+        unsigned long height = 0;
+        unsigned int levels  = 1;
+        block_format format  = block_format::bc1;
+    };
+
+    // the magic number and DDS_HEADER before the blocks
+    const size_t dds_header_bytes = 128;
+
+    namespace dds
+    {
+        inline unsigned long get32(const unsigned char* p)
+        {
+            return p[0] | (p[1] << 8) | (p[2] << 16) |
+                   ((unsigned long)p[3] << 24);
+        }
+
+        inline void put32(unsigned char* p, unsigned long value)
+        {
+            for (int i = 0; i < 4; ++i)
+                p[i] = (unsigned char)(value >> (8 * i));
+        }
+    }
+
+    // the header of a DDS file of BC1 or BC3 blocks, false for any other
+    // file, or one shorter than its blocks
+    inline bool read_dds_header(const unsigned char* data,
+                                size_t               size,
+                                dds_info&            info)
+    {
+        if (size < dds_header_bytes || std::memcmp(data, "DDS ", 4) != 0 ||
+            dds::get32(data + 4) != 124 || dds::get32(data + 76) != 32 ||
+            (dds::get32(data + 80) & 0x4) == 0) // DDPF_FOURCC
+            return false;
+        if (std::memcmp(data + 84, "DXT1", 4) == 0)
+            info.format = block_format::bc1;
+        else if (std::memcmp(data + 84, "DXT5", 4) == 0)
+            info.format = block_format::bc3;
+        else
+            return false;
+
+        info.height = dds::get32(data + 12);
+        info.width  = dds::get32(data + 16);
+        // DDSD_MIPMAPCOUNT, a chain ends at 1x1
+        info.levels = (dds::get32(data + 8) & 0x20000) != 0
+                          ? std::max<unsigned long>(dds::get32(data + 28), 1)
+                          : 1;
+        if (info.width == 0 || info.height == 0 || info.levels > 32 ||
+            std::max(info.width, info.height) >> (info.levels - 1) == 0)
+            return false;
+
+        size_t bytes = 0;
+        for (unsigned int level = 0; level < info.levels; ++level)
+        {
+            const unsigned long width  = info.width >> level;
+            const unsigned long height = info.height >> level;
+            bytes += blocks_size(width ? width : 1, height ? height : 1,
+                                 info.format);
+        }
+        return size - dds_header_bytes >= bytes;
+    }
+
+    inline std::vector<unsigned char> dds_header(const dds_info& info)
+    {
+        std::vector<unsigned char> header(dds_header_bytes, 0);
+        unsigned char* h = &header.front();
+        std::memcpy(h, "DDS ", 4);
+        dds::put32(h + 4, 124);
+        // CAPS, HEIGHT, WIDTH, PIXELFORMAT, LINEARSIZE, MIPMAPCOUNT
+        dds::put32(h + 8, 0x1 | 0x2 | 0x4 | 0x1000 | 0x80000 | 0x20000);
+        dds::put32(h + 12, info.height);
+        dds::put32(h + 16, info.width);
+        dds::put32(h + 20,
+                   blocks_size(info.width, info.height, info.format));
+        dds::put32(h + 28, info.levels);
+        dds::put32(h + 76, 32);
+        dds::put32(h + 80, 0x4); // DDPF_FOURCC
+        const bool bc1 = info.format == block_format::bc1;
+        std::memcpy(h + 84, bc1 ? "DXT1" : "DXT5", 4);
+        // TEXTURE, and COMPLEX and MIPMAP for a chain
+        const unsigned long chain = info.levels > 1 ? 0x8 | 0x400000 : 0;
+        dds::put32(h + 108, 0x1000 | chain);
+        return header;
+    }
+
+    // the four colors of a BC1 block as RGBA. With three_colors, as in BC1
+    // alone, a first color not greater than the second gives the 3 color
+    // mode, with black last, opaque as GL_COMPRESSED_RGB_S3TC_DXT1_EXT has
+    // it; BC3 always has four
+    inline void bc1_palette(const unsigned char* block,
+                            unsigned char        colors[4][4],
+                            bool                 three_colors)
+    {
+        const unsigned int c0 = block[0] | (block[1] << 8);
+        const unsigned int c1 = block[2] | (block[3] << 8);
+        for (int i = 0; i < 2; ++i)
+        {
+            const unsigned int c = i == 0 ? c0 : c1;
+            const unsigned int r = (c >> 11) & 31;
+            const unsigned int g = (c >> 5) & 63;
+            const unsigned int b = c & 31;
+            colors[i][0]         = (unsigned char)((r << 3) | (r >> 2));
+            colors[i][1]         = (unsigned char)((g << 2) | (g >> 4));
+            colors[i][2]         = (unsigned char)((b << 3) | (b >> 2));
+            colors[i][3]         = 255;
+        }
+        for (int k = 0; k < 3; ++k)
+        {
+            if (c0 > c1 || !three_colors)
+            {
+                colors[2][k] = (unsigned char)((2 * colors[0][k] +
+                                                colors[1][k] + 1) / 3);
+                colors[3][k] = (unsigned char)((colors[0][k] +
+                                                2 * colors[1][k] + 1) / 3);
+            }
+            else
+            {
+                colors[2][k] =
+                    (unsigned char)((colors[0][k] + colors[1][k] + 1) / 2);
+                colors[3][k] = 0;
+            }
+        }
+        colors[2][3] = 255;
+        colors[3][3] = 255;
+    }
+
+    // the eight alpha values of a BC3 block
+    inline void bc3_alphas(const unsigned char* block, unsigned char alphas[8])
+    {
+        const unsigned int a0 = block[0], a1 = block[1];
+        alphas[0] = (unsigned char)a0;
+        alphas[1] = (unsigned char)a1;
+        if (a0 > a1)
+        {
+            for (unsigned int i = 1; i < 7; ++i)
+                alphas[i + 1] =
+                    (unsigned char)(((7 - i) * a0 + i * a1 + 3) / 7);
+        }
+        else
+        {
+            for (unsigned int i = 1; i < 5; ++i)
+                alphas[i + 1] =
+                    (unsigned char)(((5 - i) * a0 + i * a1 + 2) / 5);
+            alphas[6] = 0;
+            alphas[7] = 255;
+        }
+    }
+
+    // the texels of a block to RGBA at out, rows stride bytes apart, as
+    // many of the 4x4 as width and height leave of it
+    inline void decode_block(const unsigned char* block,
+                             block_format         format,
+                             unsigned char*       out,
+                             size_t               stride,
+                             unsigned long        width,
+                             unsigned long        height)
+    {
+        const bool bc3             = format == block_format::bc3;
+        const unsigned char* color = bc3 ? block + 8 : block;
+        unsigned char colors[4][4];
+        bc1_palette(color, colors, !bc3);
+        unsigned char alphas[8];
+        unsigned long long alpha_bits = 0;
+        if (bc3)
+        {
+            bc3_alphas(block, alphas);
+            for (int i = 7; i >= 2; --i)
+                alpha_bits = (alpha_bits << 8) | block[i];
+        }
+
+        const unsigned long bits = dds::get32(color + 4);
+        for (unsigned long y = 0; y < 4 && y < height; ++y)
+        {
+            for (unsigned long x = 0; x < 4 && x < width; ++x)
+            {
+                const unsigned int t = y * 4 + x;
+                unsigned char* texel = out + y * stride + x * 4;
+                std::memcpy(texel, colors[(bits >> (2 * t)) & 3], 4);
+                if (bc3)
+                    texel[3] = alphas[(alpha_bits >> (3 * t)) & 7];
+            }
+        }
+    }
+
+    // an image of blocks to width x height RGBA texels
+    inline void decode_blocks(const unsigned char* blocks,
+                              unsigned long        width,
+                              unsigned long        height,
+                              block_format         format,
+                              unsigned char*       rgba)
+    {
+        const size_t bytes = block_bytes(format);
+        for (unsigned long y = 0; y < height; y += 4)
+        {
+            for (unsigned long x = 0; x < width; x += 4, blocks += bytes)
+            {
+                decode_block(blocks,
+                             format,
+                             rgba + (y * width + x) * 4,
+                             width * 4,
+                             width - x,
+                             height - y);
+            }
+        }
+    }
+}
@@ -4,6 +4,7 @@
 #include "engine_types.hpp"
 #include <cstdlib>
 #include <string>
+#include <vector>
 
 namespace ge
 {
@@ -24,10 +25,126 @@ namespace ge
         virtual triangle transform_triangle(const triangle& trSrc,
                                             const triangle& trDest,
                                             float alpha)   = 0;
+        /**
+         * binds the texture of path, loaded through the texture cache on
+         * the first call and kept there until uninit_engine. A texture
+         * evicted by the texture budget is loaded again from its file first.
+         * render draws with the texture of the last draw_texture, loads and
+         * swap_buffers leave it bound
+         */
         virtual void draw_texture(const std::string& path) = 0;
+        virtual void draw_texture(texture_handle handle)   = 0;
+        /**
+         * returns the texture of a PNG file, 0 if it can't be loaded. Paths
+         * naming the same file share one texture, which is decoded and
+         * uploaded by the first load only. Each load takes a reference that
+         * release_texture gives back. A DDS file of tools/texture_compressor
+         * is uploaded as its BC1 or BC3 blocks where the driver has S3TC,
+         * and as RGBA decoded from them where it doesn't, with the mipmap
+         * chain it has whatever set_mip_filter says. So is a .btex file of
+         * tools/texture_baker, which is mapped and uploaded from the mapping
+         * with nothing to decode
+         */
+        virtual texture_handle load_texture(const std::string& path) = 0;
+        /**
+         * gives back a reference taken by load_texture, load_textures or
+         * load_texture_progressive, the texture is deleted with the last one
+         */
+        virtual void release_texture(texture_handle handle) = 0;
+        virtual texture_cache_stats get_texture_cache_stats() = 0;
+        /**
+         * reads a manifest of tools/atlas_builder and loads its pages
+         * through the texture cache, where they stay until uninit_engine.
+         * Returns false if the manifest or one of its pages can't be read
+         */
+        virtual bool load_atlas(const std::string& manifest_path) = 0;
+        /**
+         * finds the page and rectangle of a sprite of a loaded atlas by
+         * the path it was packed from, false if no atlas has it
+         */
+        virtual bool find_atlas_region(const std::string& path,
+                                       atlas_region& region) = 0;
+        /**
+         * decodes textures on a pool of worker threads and uploads them
+         * on the calling thread, handles are in the order of paths and
+         * come from the texture cache as those of load_texture
+         */
+        virtual std::vector<texture_handle>
+        load_textures(const std::vector<std::string>& paths) = 0;
+        /**
+         * returns a texture at once, a transparent pixel until a worker
+         * thread has decoded the PNG. An Adam7 interlaced PNG shows up
+         * blocky as soon as its first pass is read and gets sharper with
+         * each later one, others once they are decoded. New versions are
+         * uploaded by swap_buffers. The texture is cached as those of
+         * load_texture. A .dds or .btex file has no passes and is loaded
+         * as load_texture_async does
+         */
+        virtual texture_handle
+        load_texture_progressive(const std::string& path) = 0;
+        /**
+         * load_texture without waiting: returns at once a texture drawn
+         * transparent, which a worker thread reads and decodes the PNG for
+         * and swap_buffers uploads, within the upload budget. It stays
+         * transparent until all of it is uploaded
+         */
+        virtual texture_handle load_texture_async(const std::string& path) = 0;
+        /**
+         * false while a texture of load_texture_async or
+         * load_texture_progressive is still to be decoded or uploaded
+         */
+        virtual bool texture_ready(texture_handle handle) = 0;
+        /**
+         * true once a texture of load_texture_async or
+         * load_texture_progressive is ready but its file couldn't be
+         * opened or decoded: it stays transparent, or as blocky as the
+         * last pass read before the error
+         */
+        virtual bool texture_failed(texture_handle handle) = 0;
+        /**
+         * limits what swap_buffers uploads of streamed textures each frame
+         * to bytes_per_frame and to ms_per_frame, 0 for no limit, which is
+         * the default. Large textures are uploaded a band of rows at a
+         * time, at least one row each frame
+         */
+        virtual void set_upload_budget(size_t bytes_per_frame,
+                                       float ms_per_frame) = 0;
+        /**
+         * totals since init_engine of the uploads of streamed textures.
+         * Where the driver has sync objects, their rows are staged through
+         * a ring of pixel buffers and the upload from each overlaps with
+         * rendering, blocked_ms is the wait for one to be free again
+         */
+        virtual texture_upload_stats get_texture_upload_stats() = 0;
+        /**
+         * gives the textures loaded from now on a mipmap chain down to 1x1,
+         * made by filter where they are decoded, on the loader threads for
+         * all but load_texture, and sampled GL_LINEAR_MIPMAP_LINEAR when
+         * minified. mip_filter::none, the default, keeps level 0 alone
+         * sampled nearest. Textures already cached stay as they were loaded,
+         * and load_texture_progressive ones have no chain
+         */
+        virtual void set_mip_filter(mip_filter filter) = 0;
+        /**
+         * limits the texel bytes of the cached textures in GPU memory to
+         * bytes, 0 for no limit, which is the default. Past it the textures
+         * least recently drawn are evicted: their handles stay valid, and
+         * draw_texture loads them again from their PNG, DDS or baked file,
+         * as load_texture_async does, so they are drawn transparent until
+         * swap_buffers has uploaded them. Textures still streaming, the one
+         * just loaded and the one of the last draw_texture, which render
+         * draws with, are kept, so a budget smaller than those is exceeded
+         */
+        virtual void set_texture_budget(unsigned long long bytes) = 0;
     };
 
     IEngine* GE_DECLSPEC getInstance();
+    /**
+     * turns the texture coordinates of tx, 0 to 1 over the sprite image,
+     * into those of the sprite in its atlas page. Coordinates past the
+     * sprite would reach into its neighbours, an atlas doesn't repeat
+     */
+    void GE_DECLSPEC remap_tex_coords(const atlas_region& region, texture& tx);
     std::istream& GE_DECLSPEC operator>>(std::istream& is, vertex& v);
     std::istream& GE_DECLSPEC operator>>(std::istream& is, triangle& tr);
     std::istream& GE_DECLSPEC operator>>(std::istream& is, texture& tx);
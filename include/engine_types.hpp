@@ -52,6 +52,52 @@ namespace ge
         std::vector<vertex> v = { vertex(), vertex(), vertex() };
     };
 
+    // how the mipmap chain of a texture is made, see mipmap.hpp
+    enum class mip_filter
+    {
+        none,  // level 0 only, sampled nearest
+        box,   // 2x2 mean of the stored bytes
+        linear // 2x2 mean in linear light, weighted by alpha
+    };
+
+    // name of a texture uploaded by the engine, 0 if loading failed
+    using texture_handle = unsigned int;
+
+    // what the texture cache of the engine holds and how it was used
+    struct GE_DECLSPEC texture_cache_stats
+    {
+        unsigned long long hits   = 0; // loads of a path already loaded
+        unsigned long long misses = 0; // loads that decoded the file
+        // texel bytes uploaded for the textures in GPU memory now
+        unsigned long long resident_bytes = 0;
+        size_t textures                   = 0; // textures cached now
+        size_t resident_textures          = 0; // of them, not evicted
+        // textures evicted to keep within the budget, and evicted ones
+        // loaded again from their file to be drawn
+        unsigned long long evictions = 0;
+        unsigned long long reloads   = 0;
+    };
+
+    // what swap_buffers spent uploading streamed textures
+    struct GE_DECLSPEC texture_upload_stats
+    {
+        unsigned long long bytes = 0; // texel bytes uploaded
+        double upload_ms         = 0; // spent uploading them
+        double blocked_ms        = 0; // of that, waiting for a pixel buffer
+        // staged through pixel buffers, rather than from client memory
+        bool pixel_buffers = false;
+    };
+
+    // where a sprite atlas_builder packed is in its atlas page, in texture
+    // coordinates of the page
+    struct GE_DECLSPEC atlas_region
+    {
+        texture_handle page = 0;
+        vertex min;           // bottom left corner of the sprite
+        vertex max;           // top right corner
+        bool rotated = false; // stored turned 90 degrees clockwise
+    };
+
     struct GE_DECLSPEC texture
     {
         std::vector<vertex> coords     = { vertex(), vertex(), vertex() };
@@ -0,0 +1,369 @@
+#pragma once
+
+#include "SDL_cpuinfo.h"
+#include "engine_types.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+/*
+Mipmap chains built on the CPU, for textures uploaded with all of their
+levels and sampled GL_LINEAR_MIPMAP_LINEAR. Each level is made from the one
+before it by a filter over 2x2 blocks; an odd last row or column is dropped
+and a side of 1 is sampled twice, so every level is half the one before,
+rounded down, as GL wants it.
+
+mip_filter::box averages the stored bytes. Its SSSE3 and AVX2 kernels are
+picked at runtime with the CPU detection of SDL and give exactly the bytes of
+the scalar code. mip_filter::linear treats grey and color channels as sRGB,
+averages them in linear light weighted by alpha, so transparent texels don't
+darken the edges of a sprite, and is scalar only.
+*/
+
+#if (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||           \
+     defined(_M_IX86)) &&                                                      \
+    !defined(GE_MIPMAP_NO_SIMD)
+#define GE_MIPMAP_X86_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define GE_MIPMAP_TARGET(isa)
+#else
+#define GE_MIPMAP_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace ge
+{
+    // out gets pixels pixels of channels bytes, each the rounded mean of the
+    // 2x2 block of the rows a and b under it, which hold twice as many.
+    // Returns how many were done, the scalar code does the rest
+    typedef size_t (*box_kernel)(unsigned char*       out,
+                                 const unsigned char* a,
+                                 const unsigned char* b,
+                                 size_t               pixels,
+                                 unsigned int         channels);
+
+    // side of a level, down to 1
+    inline unsigned long mip_size(unsigned long size, unsigned int level)
+    {
+        return std::max(size >> level, 1ul);
+    }
+
+    // levels of a full chain, down to 1x1
+    inline unsigned int mip_levels(unsigned long width, unsigned long height)
+    {
+        unsigned int levels = 1;
+        while ((std::max(width, height) >> levels) != 0)
+            ++levels;
+        return levels;
+    }
+
+    // where a level starts in a chain of tightly packed levels
+    inline size_t mip_offset(unsigned long width,
+                             unsigned long height,
+                             unsigned int  channels,
+                             unsigned int  level)
+    {
+        size_t offset = 0;
+        for (unsigned int l = 0; l < level; ++l)
+            offset += size_t(mip_size(width, l)) * mip_size(height, l) *
+                      channels;
+        return offset;
+    }
+
+#ifdef GE_MIPMAP_X86_SIMD
+    namespace simd
+    {
+        // puts the two texels of each channel next to each other, for
+        // maddubs to add them: 4 output bytes take 8 input bytes, 3 take 6
+        GE_MIPMAP_TARGET("sse2")
+        inline __m128i box_pairs(unsigned int channels)
+        {
+            if (channels == 1)
+                return _mm_setr_epi8(
+                    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+            if (channels == 2)
+                return _mm_setr_epi8(
+                    0, 2, 1, 3, 4, 6, 5, 7, 8, 10, 9, 11, 12, 14, 13, 15);
+            if (channels == 3)
+                return _mm_setr_epi8(
+                    0, 3, 1, 4, 2, 5, 6, 9, 7, 10, 8, 11, -1, -1, -1, -1);
+            return _mm_setr_epi8(
+                0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+        }
+
+        GE_MIPMAP_TARGET("ssse3")
+        inline __m128i box_mean(__m128i a, __m128i b, __m128i pairs)
+        {
+            const __m128i ones = _mm_set1_epi8(1);
+            __m128i sum = _mm_add_epi16(
+                _mm_maddubs_epi16(_mm_shuffle_epi8(a, pairs), ones),
+                _mm_maddubs_epi16(_mm_shuffle_epi8(b, pairs), ones));
+            sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+            return _mm_packus_epi16(sum, sum);
+        }
+
+        GE_MIPMAP_TARGET("ssse3")
+        inline size_t box_ssse3(unsigned char*       out,
+                                const unsigned char* a,
+                                const unsigned char* b,
+                                size_t               pixels,
+                                unsigned int         channels)
+        {
+            // 16 bytes are read a step, of which 3 byte texels use 12
+            const __m128i pairs   = box_pairs(channels);
+            const size_t in_step  = channels == 3 ? 12 : 16;
+            const size_t out_step = in_step / 2;
+            const size_t in_bytes = 2 * pixels * channels;
+            size_t i = 0, o = 0;
+            for (; i + 16 <= in_bytes; i += in_step, o += out_step)
+            {
+                const __m128i mean =
+                    box_mean(_mm_loadu_si128((const __m128i*)(a + i)),
+                             _mm_loadu_si128((const __m128i*)(b + i)),
+                             pairs);
+                if (channels == 3)
+                {
+                    unsigned char bytes[8];
+                    _mm_storel_epi64((__m128i*)bytes, mean);
+                    std::memcpy(out + o, bytes, 6);
+                }
+                else
+                {
+                    _mm_storel_epi64((__m128i*)(out + o), mean);
+                }
+            }
+            return o / channels;
+        }
+
+        // box_ssse3 for 1, 2 and 4 channels, 16 output bytes a step
+        GE_MIPMAP_TARGET("avx2")
+        inline size_t box_avx2(unsigned char*       out,
+                               const unsigned char* a,
+                               const unsigned char* b,
+                               size_t               pixels,
+                               unsigned int         channels)
+        {
+            if (channels == 3)
+                return box_ssse3(out, a, b, pixels, channels);
+
+            const __m128i half    = box_pairs(channels);
+            const __m256i pairs   = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(half), half, 1);
+            const __m256i ones    = _mm256_set1_epi8(1);
+            const __m256i two     = _mm256_set1_epi16(2);
+            const size_t in_bytes = 2 * pixels * channels;
+            size_t i = 0;
+            for (; i + 32 <= in_bytes; i += 32)
+            {
+                __m256i sum = _mm256_add_epi16(
+                    _mm256_maddubs_epi16(
+                        _mm256_shuffle_epi8(
+                            _mm256_loadu_si256((const __m256i*)(a + i)),
+                            pairs),
+                        ones),
+                    _mm256_maddubs_epi16(
+                        _mm256_shuffle_epi8(
+                            _mm256_loadu_si256((const __m256i*)(b + i)),
+                            pairs),
+                        ones));
+                sum = _mm256_srli_epi16(_mm256_add_epi16(sum, two), 2);
+                // packs within each 128 bit lane, the low halves are wanted
+                const __m256i mean = _mm256_permute4x64_epi64(
+                    _mm256_packus_epi16(sum, sum), 0x08);
+                _mm_storeu_si128((__m128i*)(out + i / 2),
+                                 _mm256_castsi256_si128(mean));
+            }
+            const size_t done = i / 2 / channels;
+            return done + box_ssse3(out + i / 2,
+                                    a + i,
+                                    b + i,
+                                    pixels - done,
+                                    channels);
+        }
+    }
+#endif
+
+    inline box_kernel select_box_kernel()
+    {
+#ifdef GE_MIPMAP_X86_SIMD
+        if (SDL_HasAVX2())
+            return simd::box_avx2;
+        // SDL has no SSSE3 query, every CPU with SSE4.1 also has SSSE3
+        if (SDL_HasSSE41())
+            return simd::box_ssse3;
+#endif
+        return nullptr;
+    }
+
+    // writable as the tables of picopng_simd.hxx are, null for the scalar
+    // code alone
+    inline box_kernel& mip_box_kernel()
+    {
+        static box_kernel kernel = select_box_kernel();
+        return kernel;
+    }
+
+    // sRGB bytes in linear light, and back from linear light in steps of
+    // 1/65535 to the byte nearest to it
+    struct srgb_tables
+    {
+        float linear[256];
+        unsigned char encoded[65536];
+
+        srgb_tables()
+        {
+            for (int v = 0; v < 256; ++v)
+            {
+                const double c = v / 255.0;
+                linear[v]      = float(c <= 0.04045
+                                      ? c / 12.92
+                                      : std::pow((c + 0.055) / 1.055, 2.4));
+            }
+            int v = 0;
+            for (int i = 0; i < 65536; ++i)
+            {
+                const float value = i / 65535.f;
+                while (v < 255 && value > (linear[v] + linear[v + 1]) / 2)
+                    ++v;
+                encoded[i] = static_cast<unsigned char>(v);
+            }
+        }
+
+        unsigned char encode(float value) const
+        {
+            // a mean of weighted texels may round a little over 1
+            const float step = std::min(value, 1.f) * 65535 + 0.5f;
+            return encoded[static_cast<int>(step)];
+        }
+    };
+
+    inline const srgb_tables& srgb()
+    {
+        static const srgb_tables tables;
+        return tables;
+    }
+
+    // the texel of out at x from the 2x2 block of a and b at x0 and x1,
+    // alpha, if any, is the last channel
+    inline void mip_texel_linear(unsigned char*       out,
+                                 const unsigned char* a,
+                                 const unsigned char* b,
+                                 size_t               x0,
+                                 size_t               x1,
+                                 unsigned int         channels)
+    {
+        const srgb_tables& tables = srgb();
+        const unsigned char* texels[4] = {
+            a + x0 * channels, a + x1 * channels, b + x0 * channels,
+            b + x1 * channels
+        };
+        const bool alpha         = channels == 2 || channels == 4;
+        const unsigned int color = alpha ? channels - 1 : channels;
+        float weights[4]         = { 1, 1, 1, 1 };
+        float total              = 4;
+        if (alpha)
+        {
+            unsigned int sum = 0;
+            for (int t = 0; t < 4; ++t)
+                sum += texels[t][color];
+            out[color] = static_cast<unsigned char>((sum + 2) / 4);
+            // all transparent, the colors are averaged as they are
+            if (sum != 0)
+            {
+                for (int t = 0; t < 4; ++t)
+                    weights[t] = texels[t][color];
+                total = float(sum);
+            }
+        }
+        for (unsigned int c = 0; c < color; ++c)
+        {
+            float sum = 0;
+            for (int t = 0; t < 4; ++t)
+                sum += tables.linear[texels[t][c]] * weights[t];
+            out[c] = tables.encode(sum / total);
+        }
+    }
+
+    // makes level out, of out_width x out_height, from level in below it
+    inline void mip_level(unsigned char*       out,
+                          unsigned long        out_width,
+                          unsigned long        out_height,
+                          const unsigned char* in,
+                          unsigned long        in_width,
+                          unsigned long        in_height,
+                          unsigned int         channels,
+                          mip_filter           filter)
+    {
+        const box_kernel kernel = mip_box_kernel();
+        const size_t in_row     = size_t(in_width) * channels;
+        const size_t out_row    = size_t(out_width) * channels;
+        for (unsigned long y = 0; y < out_height; ++y)
+        {
+            const unsigned char* a =
+                in + std::min(2 * y, in_height - 1) * in_row;
+            const unsigned char* b =
+                in + std::min(2 * y + 1, in_height - 1) * in_row;
+            unsigned char* row = out + y * out_row;
+
+            size_t x = 0;
+            if (filter == mip_filter::linear)
+            {
+                for (; x < out_width; ++x)
+                    mip_texel_linear(row + x * channels,
+                                     a,
+                                     b,
+                                     std::min<size_t>(2 * x, in_width - 1),
+                                     std::min<size_t>(2 * x + 1, in_width - 1),
+                                     channels);
+                continue;
+            }
+
+            // a column of 1 is sampled twice, which the kernels don't do
+            if (kernel != nullptr && in_width > 1)
+                x = kernel(row, a, b, out_width, channels);
+            for (; x < out_width; ++x)
+            {
+                const size_t x0 = std::min<size_t>(2 * x, in_width - 1);
+                const size_t x1 = std::min<size_t>(2 * x + 1, in_width - 1);
+                for (unsigned int c = 0; c < channels; ++c)
+                {
+                    const unsigned int sum =
+                        a[x0 * channels + c] + a[x1 * channels + c] +
+                        b[x0 * channels + c] + b[x1 * channels + c];
+                    row[x * channels + c] =
+                        static_cast<unsigned char>((sum + 2) / 4);
+                }
+            }
+        }
+    }
+
+    // appends the levels below level 0, which image holds, down to 1x1
+    inline void build_mip_chain(std::vector<unsigned char>& image,
+                                unsigned long               width,
+                                unsigned long               height,
+                                unsigned int                channels,
+                                mip_filter                  filter)
+    {
+        const unsigned int levels = mip_levels(width, height);
+        if (filter == mip_filter::none || levels == 1)
+            return;
+
+        image.resize(mip_offset(width, height, channels, levels));
+        for (unsigned int level = 1; level < levels; ++level)
+        {
+            const size_t in  = mip_offset(width, height, channels, level - 1);
+            const size_t out = mip_offset(width, height, channels, level);
+            mip_level(&image[out],
+                      mip_size(width, level),
+                      mip_size(height, level),
+                      &image[in],
+                      mip_size(width, level - 1),
+                      mip_size(height, level - 1),
+                      channels,
+                      filter);
+        }
+    }
+}
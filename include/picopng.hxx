@@ -1,35 +1,15 @@
+#include "picopng_simd.hxx"
+#include <algorithm>
+#include <cstring>
 #include <vector>
+#ifdef _WIN32
+#include <cstdio>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
-/*
-decodePNG: The picoPNG function, decodes a PNG file buffer in memory, into a raw
-pixel buffer.
-out_image: output parameter, this will contain the raw pixels after decoding.
-  By default the output is 32-bit RGBA color.
-  The std::vector is automatically resized to the correct size.
-image_width: output_parameter, this will contain the width of the image in
-pixels.
-image_height: output_parameter, this will contain the height of the image in
-pixels.
-in_png: pointer to the buffer of the PNG file in memory. To get it from a file
-on
-  disk, load it and store it in a memory buffer yourself first.
-in_size: size of the input PNG file in bytes.
-convert_to_rgba32: optional parameter, true by default.
-  Set to true to get the output in RGBA 32-bit (8 bit per channel) color format
-  no matter what color type the original PNG image had. This gives predictable,
-  useable data from any random input PNG.
-  Set to false to do no color conversion at all. The result then has the same
-data
-  type as the PNG image, which can range from 1 bit to 64 bits per pixel.
-  Information about the color type or palette colors are not provided. You need
-  to know this information yourself to be able to use the data so this only
-  works for trusted PNG files. Use LodePNG instead of picoPNG if you need this
-information.
-return: 0 if success, not 0 if some error occured.
-*/
-int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
-              unsigned long& image_height, const unsigned char* in_png,
-              size_t in_size, bool convert_to_rgba32 = true)
+namespace picopng
 {
     // picoPNG version 20101224
     // Copyright (c) 2005-2010 Lode Vandevenne
@@ -53,7 +33,7 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
     //     3. This notice may not be removed or altered from any source
     //     distribution.
 
-    // picoPNG is a PNG decoder in one C++ function of around 500 lines. Use
+    // picoPNG was a PNG decoder in one C++ function of around 500 lines. Use
     // picoPNG for
     // programs that need only 1 .cpp file. Since it's a single function, it's
     // very limited,
@@ -64,6 +44,10 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
     // is available: LodePNG (lodepng.c(pp)), which is a single source and
     // header file.
     // Apologies for the compact code style, it's to make this tiny.
+    //
+    // This is an altered version of picoPNG, modified for the Game_texture
+    // engine. Its nested structs now live in the picopng namespace so that
+    // other decoders, like the StreamDecoder below, can share them.
 
     static const unsigned long LENBASE[29] = {
         3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
@@ -81,206 +65,437 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
                                                  3,  3,  4,  4,  5,  5, 6,  6,
                                                  7,  7,  8,  8,  9,  9, 10, 10,
                                                  11, 11, 12, 12, 13, 13 };
+    static const size_t ADAM7[28] = {
+        0, 4, 0, 2, 0, 1, 0, 0, 0, 4, 0, 2, 0, 1,
+        8, 8, 4, 4, 2, 2, 1, 8, 8, 8, 4, 4, 2, 2
+    }; // left, top, x spacing and y spacing of the Adam7 passes
     static const unsigned long CLCL[19] = {
         16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
     };          // code length code lengths
     struct Zlib // nested functions for zlib decompression
     {
-        static unsigned long readBitFromStream(size_t&              bitp,
-                                               const unsigned char* bits)
-        {
-            unsigned long result = (bits[bitp >> 3] >> (bitp & 0x7)) & 1;
-            bitp++;
-            return result;
-        }
-        static unsigned long readBitsFromStream(size_t&              bitp,
-                                                const unsigned char* bits,
-                                                size_t               nbits)
+        struct BitReader // reads the LSB-first bit stream of deflate
         {
-            unsigned long result = 0;
-            for (size_t i = 0; i < nbits; i++)
-                result += (readBitFromStream(bitp, bits)) << i;
-            return result;
-        }
+            // The next bits of the stream are kept in a 64-bit accumulator
+            // that is refilled a whole word at a time, so peek and consume
+            // are constant time. Near the end of the input the refill falls
+            // back to loading single bytes, and once the input is exhausted
+            // the accumulator is padded with zero bits; has() tells whether
+            // they are real.
+            const unsigned char* data;
+            size_t               size, pos; // input length and next byte to
+                                            // load into the accumulator
+            unsigned long long   buf;       // bits not consumed yet, LSB first
+            unsigned int         count;     // number of valid bits in buf
+            void init(const unsigned char* in, size_t inlength)
+            {
+                data  = in;
+                size  = inlength;
+                pos   = 0;
+                buf   = 0;
+                count = 0;
+            }
+            void refill() // guarantees at least 56 valid bits if available
+            {
+                if (pos + 8 <= size) // fast path: load a little endian word
+                {
+                    const unsigned char* p = &data[pos];
+                    unsigned long long   word =
+                        (unsigned long long)p[0] |
+                        ((unsigned long long)p[1] << 8) |
+                        ((unsigned long long)p[2] << 16) |
+                        ((unsigned long long)p[3] << 24) |
+                        ((unsigned long long)p[4] << 32) |
+                        ((unsigned long long)p[5] << 40) |
+                        ((unsigned long long)p[6] << 48) |
+                        ((unsigned long long)p[7] << 56);
+                    buf |= word << count;
+                    pos += (63 - count) >> 3; // whole bytes that fitted
+                    count |= 56;
+                }
+                else // tail path: never read past the end of the input
+                    while (count <= 56 && pos < size)
+                    {
+                        buf |= (unsigned long long)data[pos++] << count;
+                        count += 8;
+                    }
+            }
+            bool has(unsigned int nbits) // are nbits (<= 56) available?
+            {
+                if (count < nbits)
+                    refill();
+                return count >= nbits;
+            }
+            unsigned long peek(unsigned int nbits) const // nbits <= 32
+            {
+                return (unsigned long)(buf & ((1ULL << nbits) - 1));
+            }
+            void consume(unsigned int nbits)
+            {
+                buf >>= nbits;
+                count -= nbits;
+            }
+            unsigned long read(unsigned int nbits) // caller checked has()
+            {
+                unsigned long result = peek(nbits);
+                consume(nbits);
+                return result;
+            }
+            void alignToByte()
+            {
+                consume(count & 7);
+            }
+            size_t bytePos() const // first byte not consumed, when aligned
+            {
+                return pos - count / 8;
+            }
+            void seek(size_t bytepos) // continue reading at a byte position
+            {
+                pos   = bytepos;
+                buf   = 0;
+                count = 0;
+            }
+        };
         struct HuffmanTree
         {
-            int makeFromLengths(const std::vector<unsigned long>& bitlen,
-                                unsigned long                     maxbitlen)
-            { // make tree given the lengths
-                unsigned long numcodes = (unsigned long)(bitlen.size()),
-                              treepos = 0, nodefilled = 0;
-                std::vector<unsigned long> tree1d(numcodes),
-                    blcount(maxbitlen + 1, 0), nextcode(maxbitlen + 1, 0);
+            // Codes are decoded with a two-level lookup table instead of
+            // walking a binary tree bit by bit. The first 2^rootbits entries
+            // are indexed directly by the next rootbits input bits (deflate
+            // stores Huffman codes starting with their most significant bit,
+            // so the table is indexed by bit-reversed codes). Codes longer
+            // than rootbits continue in a subtable appended after the root
+            // table, sized for the longest code sharing that root prefix.
+            // Entry layout: bits 0-3 hold the number of bits to consume
+            // (0 marks an unused code), bit 4 flags a link to a subtable whose
+            // index width is then stored in bits 0-3, and bits 16-31 hold the
+            // symbol or the subtable offset.
+            enum
+            {
+                MAXROOTBITS = 10,
+                SUBTABLE    = 0x10
+            };
+            int makeFromLengths(const unsigned long* bitlen,
+                                unsigned long numcodes, unsigned long maxbitlen)
+            { // make lookup table given the lengths, of at most 288 codes of
+              // at most 15 bits
+                unsigned long maxlen = 0;
+                unsigned long tree1d[288], blcount[16] = { 0 },
+                                           nextcode[16] = { 0 };
                 for (unsigned long bits = 0; bits < numcodes; bits++)
                     blcount[bitlen[bits]]++; // count number of instances of
                                              // each code length
+                blcount[0] = 0;              // unused symbols get no code
+                long left  = 1; // number of codes still free at this length
                 for (unsigned long bits = 1; bits <= maxbitlen; bits++)
+                {
+                    left = left * 2 - (long)blcount[bits];
+                    if (left < 0)
+                        return 55; // error: over-subscribed set of lengths
+                    if (blcount[bits])
+                        maxlen = bits;
                     nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1])
                                      << 1;
+                }
                 for (unsigned long n = 0; n < numcodes; n++)
                     if (bitlen[n] != 0)
                         tree1d[n] =
                             nextcode[bitlen[n]]++; // generate all the codes
-                tree2d.clear();
-                tree2d.resize(numcodes * 2, 32767); // 32767 here means the
-                                                    // tree2d isn't filled there
-                                                    // yet
-                for (unsigned long n = 0; n < numcodes; n++) // the codes
-                    for (unsigned long i = 0; i < bitlen[n];
-                         i++) // the bits for this code
+                rootbits = maxlen < (unsigned long)MAXROOTBITS
+                               ? maxlen
+                               : (unsigned long)MAXROOTBITS;
+                table.assign(1UL << rootbits, 0);
+                for (unsigned long n = 0; n < numcodes;
+                     n++) // find the widest subtable needed per root prefix
+                    if (bitlen[n] > rootbits)
                     {
-                        unsigned long bit =
-                            (tree1d[n] >> (bitlen[n] - i - 1)) & 1;
-                        if (treepos > numcodes - 2)
-                            return 55;
-                        if (tree2d[2 * treepos + bit] ==
-                            32767) // not yet filled in
-                        {
-                            if (i + 1 == bitlen[n])
-                            {
-                                tree2d[2 * treepos + bit] = n;
-                                treepos                   = 0;
-                            } // last bit
-                            else
-                            {
-                                tree2d[2 * treepos + bit] =
-                                    ++nodefilled + numcodes;
-                                treepos = nodefilled;
-                            } // addresses are encoded as values > numcodes
-                        }
-                        else
-                            treepos = tree2d[2 * treepos + bit] -
-                                      numcodes; // subtract numcodes from
-                                                // address to get address value
+                        unsigned int& root =
+                            table[reverseBits(tree1d[n], bitlen[n]) &
+                                  ((1UL << rootbits) - 1)];
+                        unsigned int subbits =
+                            (unsigned int)(bitlen[n] - rootbits);
+                        if ((root & 15) < subbits)
+                            root = SUBTABLE | subbits;
+                    }
+                for (unsigned long i = 0, rootsize = table.size();
+                     i < rootsize; i++) // lay out the subtables
+                    if (table[i] & SUBTABLE)
+                    {
+                        unsigned long offset = table.size();
+                        table[i] |= (unsigned int)(offset << 16);
+                        table.resize(offset + (1UL << (table[i] & 15)), 0);
+                    }
+                for (unsigned long n = 0; n < numcodes; n++) // fill in codes
+                {
+                    unsigned long len = bitlen[n];
+                    if (len == 0)
+                        continue;
+                    unsigned long code = reverseBits(tree1d[n], len);
+                    if (len <= rootbits) // every index ending in this code
+                        for (unsigned long i = code; i < (1UL << rootbits);
+                             i += (1UL << len))
+                            table[i] = (unsigned int)((n << 16) | len);
+                    else
+                    {
+                        unsigned int root =
+                            table[code & ((1UL << rootbits) - 1)];
+                        unsigned long offset = root >> 16,
+                                      sublen = len - rootbits;
+                        for (unsigned long i = code >> rootbits;
+                             i < (1UL << (root & 15)); i += (1UL << sublen))
+                            table[offset + i] =
+                                (unsigned int)((n << 16) | sublen);
                     }
+                }
                 return 0;
             }
-            int decode(bool& decoded, unsigned long& result, size_t& treepos,
-                       unsigned long bit) const
-            { // Decodes a symbol from the tree
-                unsigned long numcodes = (unsigned long)tree2d.size() / 2;
-                if (treepos >= numcodes)
-                    return 11; // error: you appeared outside the codetree
-                result  = tree2d[2 * treepos + bit];
-                decoded = (result < numcodes);
-                treepos = decoded ? 0 : result - numcodes;
-                return 0;
+            static unsigned long reverseBits(unsigned long code,
+                                             unsigned long len)
+            {
+                unsigned long result = 0;
+                for (unsigned long i = 0; i < len; i++)
+                    result |= ((code >> i) & 1) << (len - i - 1);
+                return result;
+            }
+            std::vector<unsigned int> table; // root table followed by the
+                                             // subtables for long codes
+            unsigned long rootbits = 0;      // index width of the root table
+        };
+        struct FixedTrees // the trees of every block with fixed codes (BTYPE 1)
+        {
+            HuffmanTree tree, treeD;
+            FixedTrees()
+            {
+                unsigned long bitlen[288], bitlenD[32];
+                for (size_t i = 0; i < 288; i++)
+                    bitlen[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+                for (size_t i = 0; i < 32; i++)
+                    bitlenD[i] = 5;
+                tree.makeFromLengths(bitlen, 288, 15);
+                treeD.makeFromLengths(bitlenD, 32, 15);
             }
-            std::vector<unsigned long> tree2d; // 2D representation of a huffman
-                                               // tree: The one dimension is "0"
-                                               // or "1", the other contains all
-                                               // nodes and leaves of the tree.
         };
+        static const FixedTrees& fixedTrees()
+        { // built once, on first use, then only read by every decoder
+            static const FixedTrees trees;
+            return trees;
+        }
         struct Inflator
         {
-            int  error;
-            void inflate(std::vector<unsigned char>&       out,
-                         const std::vector<unsigned char>& in, size_t inpos = 0)
-            {
-                size_t bp = 0, pos = 0; // bit pointer and byte pointer
-                error                = 0;
-                unsigned long BFINAL = 0;
-                while (!BFINAL && !error)
+            // The inflator is a state machine that can stop wherever its input
+            // runs out and carry on once it is given more, which is what the
+            // StreamDecoder below needs. Block headers and literal or
+            // length/distance pairs are decoded as a whole: if the bits of one
+            // are not all there yet, the reader is put back to where it began
+            // and the inflator is suspended rather than failing. Once streaming
+            // is off there is no more input to wait for, so then it's an error.
+            enum
+            {
+                BLOCKHEADER, // expecting BFINAL and BTYPE
+                STORED,      // copying the bytes of a stored block
+                HUFFMAN,     // decoding the symbols of a compressed block
+                DONE         // the final block has ended
+            };
+            int           error;
+            int           state      = BLOCKHEADER;
+            bool          finalblock = false; // BFINAL of the current block
+            bool          fixedcodes = false; // BTYPE 1, use fixedTrees()
+            bool          streaming  = false; // more input may follow
+            bool          suspended  = false; // waiting for more input
+            unsigned long storedleft = 0;     // bytes left in a stored block
+            unsigned char* out       = 0;     // where the inflated data goes
+            size_t         outsize   = 0;     // room there, in bytes
+            size_t         outslack  = 0;     // and scratch room after that
+            std::vector<unsigned char>* outvec = 0; // out, if it may grow
+            static const size_t SLACK = 16; // a match may write this far past
+                                            // its end, where room allows
+            void setOutput(unsigned char* buffer, size_t size,
+                           size_t slack = 0) // fixed size
+            {
+                out      = buffer;
+                outsize  = size;
+                outslack = slack;
+                outvec   = 0;
+            }
+            void setOutput(std::vector<unsigned char>& buffer) // grows
+            {
+                out      = buffer.empty() ? 0 : &buffer[0];
+                outsize  = buffer.size();
+                outslack = 0;
+                outvec   = &buffer;
+            }
+            bool makeRoom(size_t size) // for size bytes of output in total
+            {
+                if (size <= outsize)
+                    return true;
+                if (!outvec)
+                {
+                    error = 91;
+                    return false;
+                } // error: more data than the output buffer was sized for
+                outvec->resize(size * 2); // reserve more room
+                out     = &(*outvec)[0];
+                outsize = outvec->size();
+                return true;
+            }
+            void reset(bool stream)
+            {
+                error      = 0;
+                state      = BLOCKHEADER;
+                finalblock = false;
+                fixedcodes = false;
+                streaming  = stream;
+                suspended  = false;
+                storedleft = 0;
+            }
+            void run(BitReader& br, size_t& pos, size_t outlimit)
+            { // inflate until the last block ends, the input runs out or pos
+              // reaches outlimit (which a match may overshoot by 257 bytes)
+                suspended = false;
+                while (!error && !suspended && state != DONE && pos < outlimit)
+                {
+                    if (state == BLOCKHEADER)
+                        readBlockHeader(br);
+                    else if (state == STORED)
+                        inflateNoCompression(br, pos, outlimit);
+                    else
+                        inflateHuffmanBlock(br, pos, outlimit);
+                }
+            }
+            void endOfInput(int code) // the input ended in the middle of a unit
+            {
+                if (streaming)
+                    suspended = true;
+                else
+                    error = code;
+            }
+            void readBlockHeader(BitReader& br)
+            {
+                BitReader start = br;
+                if (!br.has(3))
+                {
+                    endOfInput(52);
+                    return;
+                } // error, bit pointer will jump past memory
+                finalblock          = br.read(1) != 0;
+                unsigned long BTYPE = br.read(2);
+                if (BTYPE == 3)
+                {
+                    error = 20;
+                    return;
+                } // error: invalid BTYPE
+                else if (BTYPE == 0)
                 {
-                    if (bp >> 3 >= in.size())
+                    br.alignToByte(); // go to first boundary of byte
+                    size_t p = br.bytePos();
+                    if (p + 4 > br.size)
                     {
-                        error = 52;
+                        br = start;
+                        endOfInput(52);
                         return;
                     } // error, bit pointer will jump past memory
-                    BFINAL              = readBitFromStream(bp, &in[inpos]);
-                    unsigned long BTYPE = readBitFromStream(bp, &in[inpos]);
-                    BTYPE += 2 * readBitFromStream(bp, &in[inpos]);
-                    if (BTYPE == 3)
+                    unsigned long LEN  = br.data[p] + 256 * br.data[p + 1],
+                                  NLEN = br.data[p + 2] + 256 * br.data[p + 3];
+                    if (LEN + NLEN != 65535)
                     {
-                        error = 20;
+                        error = 21;
                         return;
-                    } // error: invalid BTYPE
-                    else if (BTYPE == 0)
-                        inflateNoCompression(out, &in[inpos], bp, pos,
-                                             in.size());
-                    else
-                        inflateHuffmanBlock(out, &in[inpos], bp, pos, in.size(),
-                                            BTYPE);
+                    } // error: NLEN is not one's complement of LEN
+                    br.seek(p + 4);
+                    storedleft = LEN;
+                    state      = STORED;
+                }
+                else if (BTYPE == 1)
+                {
+                    fixedcodes = true;
+                    state      = HUFFMAN;
+                }
+                else
+                {
+                    getTreeInflateDynamic(codetree, codetreeD, br);
+                    if (suspended)
+                        br = start;
+                    else if (!error)
+                    {
+                        fixedcodes = false;
+                        state      = HUFFMAN;
+                    }
                 }
-                if (!error)
-                    out.resize(pos); // Only now we know the true size of out,
-                                     // resize it to that
-            }
-            void generateFixedTrees(HuffmanTree& tree,
-                                    HuffmanTree& treeD) // get the tree of a
-                                                        // deflated block with
-                                                        // fixed tree
-            {
-                std::vector<unsigned long> bitlen(288, 8), bitlenD(32, 5);
-                ;
-                for (size_t i = 144; i <= 255; i++)
-                    bitlen[i] = 9;
-                for (size_t i = 256; i <= 279; i++)
-                    bitlen[i] = 7;
-                tree.makeFromLengths(bitlen, 15);
-                treeD.makeFromLengths(bitlenD, 15);
             }
             HuffmanTree codetree, codetreeD,
                 codelengthcodetree; // the code tree for Huffman codes, dist
-                                    // codes, and code length codes
-            unsigned long huffmanDecodeSymbol(const unsigned char* in,
-                                              size_t&              bp,
-                                              const HuffmanTree&   codetree,
-                                              size_t               inlength)
+                                    // codes, and code length codes of dynamic
+                                    // blocks
+            unsigned long huffmanDecodeSymbol(BitReader&         br,
+                                              const HuffmanTree& codetree)
             { // decode a single symbol from given list of bits with given code
               // tree. return value is the symbol
-                bool          decoded;
-                unsigned long ct;
-                for (size_t treepos = 0;;)
+                if (br.count < 15) // the longest code, may be zero padded
+                    br.refill();
+                unsigned long bits  = br.peek(15);
+                unsigned int  entry =
+                    codetree.table[bits & ((1UL << codetree.rootbits) - 1)];
+                unsigned int used = 0;
+                if (entry & HuffmanTree::SUBTABLE) // long code, second level
                 {
-                    if ((bp & 0x07) == 0 && (bp >> 3) > inlength)
-                    {
-                        error = 10;
-                        return 0;
-                    } // error: end reached without endcode
-                    error = codetree.decode(decoded, ct, treepos,
-                                            readBitFromStream(bp, in));
-                    if (error)
-                        return 0; // stop, an error happened
-                    if (decoded)
-                        return ct;
+                    used  = (unsigned int)codetree.rootbits;
+                    entry = codetree.table[(entry >> 16) +
+                                           ((bits >> used) &
+                                            ((1UL << (entry & 15)) - 1))];
                 }
-                return 0;
+                if ((entry & 15) == 0)
+                {
+                    if (streaming && br.count < 15)
+                        suspended = true; // padding, the real bits may differ
+                    else
+                        error = 11;
+                    return 0;
+                } // error: the bits are not a code of this tree
+                used += (entry & 15);
+                if (used > br.count)
+                {
+                    endOfInput(10);
+                    return 0;
+                } // error: end reached without endcode
+                br.consume(used);
+                return entry >> 16;
             }
             void getTreeInflateDynamic(HuffmanTree& tree, HuffmanTree& treeD,
-                                       const unsigned char* in, size_t& bp,
-                                       size_t inlength)
+                                       BitReader& br)
             { // get the tree of a deflated block with dynamic tree, the tree
               // itself is also Huffman compressed with a known tree
-                std::vector<unsigned long> bitlen(288, 0), bitlenD(32, 0);
-                if (bp >> 3 >= inlength - 2)
+                unsigned long bitlen[288] = { 0 }, bitlenD[32] = { 0 };
+                if (!br.has(14))
                 {
-                    error = 49;
+                    endOfInput(49);
                     return;
                 } // the bit pointer is or will go past the memory
-                size_t HLIT = readBitsFromStream(bp, in, 5) +
-                              257; // number of literal/length codes + 257
-                size_t HDIST = readBitsFromStream(bp, in, 5) +
-                               1; // number of dist codes + 1
-                size_t HCLEN = readBitsFromStream(bp, in, 4) +
-                               4; // number of code length codes + 4
-                std::vector<unsigned long> codelengthcode(19); // lengths of
-                                                               // tree to decode
-                                                               // the lengths of
-                                                               // the dynamic
-                                                               // tree
+                size_t HLIT  = br.read(5) + 257; // number of literal/length
+                                                 // codes + 257
+                size_t HDIST = br.read(5) + 1;   // number of dist codes + 1
+                size_t HCLEN = br.read(4) + 4;   // number of code length codes
+                                                 // + 4
+                unsigned long codelengthcode[19]; // lengths of tree to
+                                                  // decode the lengths of
+                                                  // the dynamic tree
                 for (size_t i = 0; i < 19; i++)
-                    codelengthcode[CLCL[i]] =
-                        (i < HCLEN) ? readBitsFromStream(bp, in, 3) : 0;
-                error = codelengthcodetree.makeFromLengths(codelengthcode, 7);
+                {
+                    if (i < HCLEN && !br.has(3))
+                    {
+                        endOfInput(49);
+                        return;
+                    } // the bit pointer is or will go past the memory
+                    codelengthcode[CLCL[i]] = (i < HCLEN) ? br.read(3) : 0;
+                }
+                error =
+                    codelengthcodetree.makeFromLengths(codelengthcode, 19, 7);
                 if (error)
                     return;
                 size_t i = 0, replength;
                 while (i < HLIT + HDIST)
                 {
-                    unsigned long code = huffmanDecodeSymbol(
-                        in, bp, codelengthcodetree, inlength);
-                    if (error)
+                    unsigned long code =
+                        huffmanDecodeSymbol(br, codelengthcodetree);
+                    if (error || suspended)
                         return;
                     if (code <= 15)
                     {
@@ -291,12 +506,17 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
                     }                    // a length code
                     else if (code == 16) // repeat previous
                     {
-                        if (bp >> 3 >= inlength)
+                        if (!br.has(2))
                         {
-                            error = 50;
+                            endOfInput(50);
                             return;
                         } // error, bit pointer jumps past memory
-                        replength = 3 + readBitsFromStream(bp, in, 2);
+                        replength = 3 + br.read(2);
+                        if (i == 0)
+                        {
+                            error = 54;
+                            return;
+                        } // error: there is no previous code to repeat
                         unsigned long value; // set value to the previous code
                         if ((i - 1) < HLIT)
                             value = bitlen[i - 1];
@@ -318,12 +538,12 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
                     }
                     else if (code == 17) // repeat "0" 3-10 times
                     {
-                        if (bp >> 3 >= inlength)
+                        if (!br.has(3))
                         {
-                            error = 50;
+                            endOfInput(50);
                             return;
                         } // error, bit pointer jumps past memory
-                        replength = 3 + readBitsFromStream(bp, in, 3);
+                        replength = 3 + br.read(3);
                         for (size_t n = 0; n < replength;
                              n++) // repeat this value in the next lengths
                         {
@@ -340,12 +560,12 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
                     }
                     else if (code == 18) // repeat "0" 11-138 times
                     {
-                        if (bp >> 3 >= inlength)
+                        if (!br.has(7))
                         {
-                            error = 50;
+                            endOfInput(50);
                             return;
                         } // error, bit pointer jumps past memory
-                        replength = 11 + readBitsFromStream(bp, in, 7);
+                        replength = 11 + br.read(7);
                         for (size_t n = 0; n < replength;
                              n++) // repeat this value in the next lengths
                         {
@@ -372,124 +592,144 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
                     error = 64;
                     return;
                 } // the length of the end code 256 must be larger than 0
-                error = tree.makeFromLengths(bitlen, 15);
+                error = tree.makeFromLengths(bitlen, 288, 15);
                 if (error)
                     return; // now we've finally got HLIT and HDIST, so generate
                             // the code trees, and the function is done
-                error = treeD.makeFromLengths(bitlenD, 15);
+                error = treeD.makeFromLengths(bitlenD, 32, 15);
                 if (error)
                     return;
             }
-            void inflateHuffmanBlock(std::vector<unsigned char>& out,
-                                     const unsigned char* in, size_t& bp,
-                                     size_t& pos, size_t inlength,
-                                     unsigned long btype)
+            void inflateHuffmanBlock(BitReader& br, size_t& pos,
+                                     size_t outlimit)
             {
-                if (btype == 1)
+                const HuffmanTree& tree =
+                    fixedcodes ? fixedTrees().tree : codetree;
+                const HuffmanTree& treeD =
+                    fixedcodes ? fixedTrees().treeD : codetreeD;
+                while (pos < outlimit)
                 {
-                    generateFixedTrees(codetree, codetreeD);
-                }
-                else if (btype == 2)
-                {
-                    getTreeInflateDynamic(codetree, codetreeD, in, bp,
-                                          inlength);
-                    if (error)
-                        return;
-                }
-                for (;;)
-                {
-                    unsigned long code =
-                        huffmanDecodeSymbol(in, bp, codetree, inlength);
-                    if (error)
+                    BitReader     start = br; // where this symbol begins
+                    unsigned long code  = huffmanDecodeSymbol(br, tree);
+                    if (error || suspended)
+                    {
+                        br = start;
                         return;
+                    }
                     if (code == 256)
-                        return;           // end code
+                    {
+                        state = finalblock ? DONE : BLOCKHEADER;
+                        return; // end code
+                    }
                     else if (code <= 255) // literal symbol
                     {
-                        if (pos >= out.size())
-                            out.resize((pos + 1) * 2); // reserve more room
+                        if (pos >= outsize && !makeRoom(pos + 1))
+                            return;
                         out[pos++] = (unsigned char)(code);
                     }
                     else if (code >= 257 && code <= 285) // length code
                     {
-                        size_t length       = LENBASE[code - 257],
-                               numextrabits = LENEXTRA[code - 257];
-                        if ((bp >> 3) >= inlength)
+                        size_t length = LENBASE[code - 257];
+                        unsigned int numextrabits =
+                            (unsigned int)LENEXTRA[code - 257];
+                        if (!br.has(numextrabits))
                         {
-                            error = 51;
+                            br = start;
+                            endOfInput(51);
                             return;
                         } // error, bit pointer will jump past memory
-                        length += readBitsFromStream(bp, in, numextrabits);
-                        unsigned long codeD =
-                            huffmanDecodeSymbol(in, bp, codetreeD, inlength);
-                        if (error)
+                        length += br.read(numextrabits);
+                        unsigned long codeD = huffmanDecodeSymbol(br, treeD);
+                        if (error || suspended)
+                        {
+                            br = start;
                             return;
+                        }
                         if (codeD > 29)
                         {
                             error = 18;
                             return;
                         } // error: invalid dist code (30-31 are never used)
-                        unsigned long dist          = DISTBASE[codeD],
-                                      numextrabitsD = DISTEXTRA[codeD];
-                        if ((bp >> 3) >= inlength)
+                        unsigned long dist = DISTBASE[codeD];
+                        unsigned int  numextrabitsD =
+                            (unsigned int)DISTEXTRA[codeD];
+                        if (!br.has(numextrabitsD))
                         {
-                            error = 51;
+                            br = start;
+                            endOfInput(51);
                             return;
                         } // error, bit pointer will jump past memory
-                        dist += readBitsFromStream(bp, in, numextrabitsD);
-                        size_t start = pos, back = start - dist; // backwards
-                        if (pos + length >= out.size())
-                            out.resize((pos + length) * 2); // reserve more room
-                        for (size_t i = 0; i < length; i++)
+                        dist += br.read(numextrabitsD);
+                        if (dist > pos)
                         {
-                            out[pos++] = out[back++];
-                            if (back >= start)
-                                back = start - dist;
-                        }
+                            error = 52;
+                            return;
+                        } // error: distance points before the output start
+                        if (pos + length > outsize && !makeRoom(pos + length))
+                            return;
+                        copyMatch(pos, dist, length);
+                        pos += length;
                     }
+                    else
+                    {
+                        error = 16;
+                        return;
+                    } // error: symbols 286 and 287 never occur in valid data
                 }
             }
-            void inflateNoCompression(std::vector<unsigned char>& out,
-                                      const unsigned char* in, size_t& bp,
-                                      size_t& pos, size_t inlength)
-            {
-                while ((bp & 0x7) != 0)
-                    bp++; // go to first boundary of byte
-                size_t p = bp / 8;
-                if (p >= inlength - 4)
-                {
-                    error = 52;
-                    return;
-                } // error, bit pointer will jump past memory
-                unsigned long LEN  = in[p] + 256 * in[p + 1],
-                              NLEN = in[p + 2] + 256 * in[p + 3];
-                p += 4;
-                if (LEN + NLEN != 65535)
-                {
-                    error = 21;
+            void copyMatch(size_t pos, size_t dist, size_t length)
+            { // copy length bytes from dist back; if dist < length the bytes
+              // just copied are copied again, so dist bytes repeat
+                unsigned char*       dst = out + pos;
+                const unsigned char* src = dst - dist;
+                unsigned char*       end = dst + length;
+                if (pos + length + SLACK > outsize + outslack)
+                { // at the very end, no room for wide copies
+                    while (dst < end)
+                        *dst++ = *src++;
                     return;
-                } // error: NLEN is not one's complement of LEN
-                if (pos + LEN >= out.size())
-                    out.resize(pos + LEN);
-                if (p + LEN > inlength)
-                {
-                    error = 23;
+                }
+                if (dist >= 16) // 16 bytes apart, whole blocks don't overlap
+                    for (; dst < end; dst += 16, src += 16)
+                        std::memcpy(dst, src, 16);
+                else if (dist >= 8)
+                    for (; dst < end; dst += 8, src += 8)
+                        std::memcpy(dst, src, 8);
+                else // the pattern in the first 8 bytes, then stored again
+                {    // as often as it fits in 8 bytes
+                    static const unsigned char STEP[8] = {0, 8, 8, 6,
+                                                          8, 5, 6, 7};
+                    for (int i = 0; i < 8; i++)
+                        dst[i] = src[i];
+                    unsigned char pattern[8];
+                    std::memcpy(pattern, dst, 8);
+                    for (dst += STEP[dist]; dst < end; dst += STEP[dist])
+                        std::memcpy(dst, pattern, 8);
+                }
+            }
+            void inflateNoCompression(BitReader& br, size_t& pos,
+                                      size_t outlimit)
+            { // copy what input and outlimit allow of the stored block; the
+              // reader is at a byte boundary after LEN and NLEN
+                size_t p = br.bytePos(), n = storedleft;
+                if (n > br.size - p)
+                    n = br.size - p;
+                if (n > outlimit - pos)
+                    n = outlimit - pos;
+                if (pos + n > outsize && !makeRoom(pos + n))
                     return;
-                } // error: reading outside of in buffer
-                for (unsigned long n = 0; n < LEN; n++)
-                    out[pos++] = in[p++]; // read LEN bytes of literal data
-                bp = p * 8;
+                for (size_t i = 0; i < n; i++)
+                    out[pos++] = br.data[p++]; // read LEN bytes of literal data
+                br.seek(p);
+                storedleft -= n;
+                if (storedleft == 0)
+                    state = finalblock ? DONE : BLOCKHEADER;
+                else if (p == br.size)
+                    endOfInput(23); // error: reading outside of in buffer
             }
         };
-        int decompress(
-            std::vector<unsigned char>& out,
-            const std::vector<unsigned char>& in) // returns error value
+        static int checkHeader(const unsigned char* in) // the 2 header bytes
         {
-            Inflator inflator;
-            if (in.size() < 2)
-            {
-                return 53;
-            } // error, size of zlib data too small
             if ((in[0] * 256 + in[1]) % 31 != 0)
             {
                 return 24;
@@ -507,10 +747,135 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
                 return 26;
             } // error: the specification of PNG says about the zlib stream:
               // "The additional flags shall not specify a preset dictionary."
-            inflator.inflate(out, in, 2);
-            return inflator
-                .error; // note: adler32 checksum was skipped and ignored
+            return 0;
+        }
+        static unsigned long adler32(unsigned long adler,
+                                     const unsigned char* data, size_t size)
+        { // adds size bytes to the Adler-32 adler, which starts out as 1
+            if (checksumKernels().adler32)
+                return checksumKernels().adler32(adler, data, size);
+            unsigned long s1 = adler & 0xffff, s2 = (adler >> 16) & 0xffff;
+            while (size > 0)
+            {
+                size_t n = size < 5552 ? size : 5552; // no overflow before %
+                for (size -= n; n > 0; n--)
+                {
+                    s1 += *data++;
+                    s2 += s1;
+                }
+                s1 %= 65521;
+                s2 %= 65521;
+            }
+            return (s2 << 16) | s1;
         }
+        struct ChunkInflator
+        {
+            // Inflates a zlib stream that comes split in chunks, like the
+            // IDAT chunks of a PNG, straight from where each chunk is instead
+            // of joining them first. Only when a block header or a symbol
+            // straddles two chunks are its few bytes copied, to carry, and
+            // topped up from the next chunk until the inflator gets past them.
+            // Inflating stops at outlimit, so the caller can use what came out
+            // while it is still in the cache, raise outlimit and go on.
+            Inflator                   inflator;
+            unsigned char              header[2];  // the zlib header
+            size_t                     headersize = 0;
+            std::vector<unsigned char> carry;       // unused end of a chunk
+            unsigned int               skipbits = 0; // used bits of the next
+                                                     // byte, carry's or not
+            size_t                     pos      = 0; // inflated bytes so far
+            size_t outlimit = (size_t)-1; // inflate no further for now
+            int                        error    = 0;
+            void init(unsigned char* out, size_t outsize, size_t slack = 0)
+            {
+                inflator.reset(true);
+                inflator.setOutput(out, outsize, slack);
+                headersize = 0;
+                carry.clear();
+                skipbits = 0;
+                pos      = 0;
+                outlimit = (size_t)-1;
+                error    = 0;
+            }
+            size_t feed(const unsigned char* data, size_t size)
+            { // inflate from a chunk until it's used up or pos reaches
+              // outlimit, returns how many of its bytes were taken
+                size_t offset = 0;
+                if (headersize < 2)
+                {
+                    while (headersize < 2 && offset < size)
+                        header[headersize++] = data[offset++];
+                    if (headersize == 2)
+                        error = checkHeader(header);
+                }
+                while (!error && offset < size &&
+                       inflator.state != Inflator::DONE && pos < outlimit)
+                {
+                    if (carry.empty())
+                    {
+                        size_t used = run(data + offset, size - offset);
+                        offset += used / 8;
+                        skipbits = (unsigned int)(used % 8);
+                        if (!error && inflator.suspended)
+                        {
+                            carry.assign(data + offset, data + size);
+                            offset = size;
+                        }
+                    }
+                    else // top it up with the start of this chunk
+                    {
+                        size_t old = carry.size(), top = size - offset;
+                        if (top > 4096)
+                            top = 4096;
+                        carry.insert(carry.end(), data + offset,
+                                     data + offset + top);
+                        size_t used = run(&carry[0], carry.size());
+                        skipbits    = (unsigned int)(used % 8);
+                        used /= 8;
+                        if (used >= old) // got into this chunk, go on there
+                        {
+                            offset += used - old;
+                            carry.clear();
+                        }
+                        else
+                        {
+                            carry.erase(carry.begin(), carry.begin() + used);
+                            offset += top;
+                        }
+                    }
+                }
+                if (error || inflator.state == Inflator::DONE)
+                    offset = size; // the rest of the chunk is of no use
+                return offset;
+            }
+            bool finish() // no more chunks, what's left must inflate now
+            { // returns false if it stopped at outlimit and has to be called
+              // again
+                inflator.streaming = false;
+                if (headersize < 2)
+                    error = 53; // error, size of zlib data too small
+                else if (!error && inflator.state != Inflator::DONE)
+                {
+                    size_t used =
+                        run(carry.empty() ? header : &carry[0], carry.size());
+                    carry.erase(carry.begin(), carry.begin() + used / 8);
+                    skipbits = (unsigned int)(used % 8);
+                }
+                // note: the adler32 checksum is left to the caller
+                return error || inflator.state == Inflator::DONE ||
+                       pos < outlimit;
+            }
+            size_t run(const unsigned char* data, size_t size)
+            { // inflate from data, returns the number of bits used
+                BitReader br;
+                br.init(data, size);
+                if (skipbits && br.has(skipbits))
+                    br.consume(skipbits);
+                inflator.run(br, pos, outlimit);
+                error = inflator.error;
+                return br.pos * 8 - br.count;
+            }
+        };
     };
     struct PNG // nested functions for PNG decoding
     {
@@ -522,10 +887,57 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
             std::vector<unsigned char> palette;
         } info;
         int  error;
+        bool bottomUp = false; // store the last row first, as GL expects
+        bool verify   = false; // check the chunk CRCs and the zlib Adler-32
+        // Scratch memory kept from one decode to the next, so that a PNG
+        // reused for many images allocates nothing more once it has decoded
+        // the largest of them
+        std::vector<unsigned char> inflated; // the scanlines, for decode
+        std::vector<unsigned char> rows; // to convert or pack, Adam7 rows
+        Zlib::ChunkInflator        zlib; // its carry and Huffman tables
+        void releaseScratch(size_t keep = 0)
+        { // free the scratch buffers larger than keep bytes
+            if (inflated.capacity() > keep)
+                std::vector<unsigned char>().swap(inflated);
+            if (rows.capacity() > keep)
+                std::vector<unsigned char>().swap(rows);
+        }
         void decode(std::vector<unsigned char>& out, const unsigned char* in,
-                    size_t size, bool convert_to_rgba32)
-        {
-            error = 0;
+                    size_t size, bool convert_to_rgba32, bool bottom_up = false,
+                    bool verify_checksums = false)
+        { // decodeInto with buffers of the right size allocated for it
+            error  = 0;
+            verify = verify_checksums; // the IHDR CRC before allocating
+            if (size == 0 || in == 0)
+            {
+                error = 48;
+                return;
+            } // the given data is empty
+            readPngHeader(&in[0], size);
+            if (error)
+                return;
+            size_t inflatedsize, imagesize;
+            getSizes(inflatedsize, imagesize, convert_to_rgba32);
+            inflated.resize(inflatedsize + Zlib::Inflator::SLACK);
+            out.resize(imagesize);
+            decodeInto(out.empty() ? 0 : &out[0], imagesize, &inflated[0],
+                       inflated.size(), in, size, convert_to_rgba32,
+                       bottom_up, verify_checksums);
+        }
+        void decodeInto(unsigned char* out, size_t outsize,
+                        unsigned char* scanlines, size_t scanlinessize,
+                        const unsigned char* in, size_t size,
+                        bool convert_to_rgba32, bool bottom_up = false,
+                        bool verify_checksums = false)
+        { // decode into buffers of at least the sizes getSizes gives: out for
+          // the image, scanlines for the inflated data. Rows are unfiltered
+          // and stored as they are inflated, Adam7 passes in place once all
+          // is inflated. Nothing else is allocated, except the carry of the
+          // ChunkInflator, its Huffman tables and two rows for converting or
+          // packing, all kept for the next decode
+            error    = 0;
+            bottomUp = bottom_up;
+            verify   = verify_checksums;
             if (size == 0 || in == 0)
             {
                 error = 48;
@@ -534,14 +946,39 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
             readPngHeader(&in[0], size);
             if (error)
                 return;
-            size_t                     pos = 33; // first byte of the first chunk after the header
-            std::vector<unsigned char> idat; // the data from idat chunks
-            bool                       IEND = false;
+            size_t inflatedsize, imagesize;
+            getSizes(inflatedsize, imagesize, convert_to_rgba32);
+            if (outsize < imagesize || scanlinessize < inflatedsize)
+            {
+                error = 90;
+                return;
+            } // error: a buffer is too small for this image
+            // length in bytes of a scanline, excluding the filtertype byte
+            unsigned long bpp        = getBpp(info);
+            size_t        linelength = (info.width * bpp + 7) / 8;
+            bool converting = convert_to_rgba32 &&
+                              (info.colorType != 6 || info.bitDepth != 8);
+            if (!converting && bpp < 8) // the pixels are or'ed in bit by bit
+                std::fill(out, out + imagesize, 0);
+            bool userows = info.interlaceMethod == 0 && (converting || bpp < 8);
+            if (userows) // unfiltered rows to store
+                rows.resize(2 * linelength);
+            // inflating stops every pipelinerows rows (some 16 KB), or at the
+            // end of an IDAT chunk, to unfilter the rows while they are still
+            // in the cache
+            size_t        pipelinerows = 16384 / (1 + linelength) + 1;
+            unsigned long y            = 0; // rows unfiltered so far
+            unsigned long adler = 1, adlerstored = 0; // computed and given
+            size_t        adlerpos = 0; // inflated bytes in adler so far
+            size_t pos = 33; // first byte of the first chunk after the header
+            // inflates the IDAT chunks one by one
+            zlib.init(scanlines, inflatedsize, scanlinessize - inflatedsize);
+            bool IEND = false;
             // bool known_type = true;
             info.key_defined = false;
+            info.palette.clear(); // of the image decoded before
             while (!IEND) // loop through the chunks, ignoring unknown chunks
-                          // and stopping at IEND chunk. IDAT data is put at the
-                          // start of the in buffer
+                          // and stopping at IEND chunk
             {
                 if (pos + 8 >= size)
                 {
@@ -556,19 +993,50 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
                     error = 63;
                     return;
                 }
-                if (pos + chunkLength >= size)
+                if (pos + 4 + chunkLength > size)
                 {
                     error = 35;
                     return;
                 } // error: size of the in buffer too small to contain next
                   // chunk
+                if (verify && (pos + 8 + chunkLength > size ||
+                               crc32(0, &in[pos], 4 + chunkLength) !=
+                                   read32bitInt(&in[pos + 4 + chunkLength])))
+                {
+                    error = pos + 8 + chunkLength > size ? 35 : 57;
+                    return;
+                } // error: the CRC of the chunk is cut off or wrong
                 if (in[pos + 0] == 'I' && in[pos + 1] == 'D' &&
                     in[pos + 2] == 'A' &&
                     in[pos + 3] ==
                         'T') // IDAT chunk, containing compressed image data
                 {
-                    idat.insert(idat.end(), &in[pos + 4],
-                                &in[pos + 4 + chunkLength]);
+                    for (size_t i = chunkLength > 4 ? chunkLength - 4 : 0;
+                         i < chunkLength; i++) // the Adler-32 ends the data
+                        adlerstored = (adlerstored << 8 | in[pos + 4 + i]) &
+                                      0xFFFFFFFFUL;
+                    for (size_t used = 0; used < chunkLength;)
+                    {
+                        if (info.interlaceMethod == 0 && y < info.height)
+                            zlib.outlimit = (y + pipelinerows) *
+                                            (1 + linelength);
+                        else
+                            zlib.outlimit = (size_t)-1;
+                        used += zlib.feed(&in[pos + 4 + used],
+                                          chunkLength - used);
+                        error = zlib.error;
+                        if (error)
+                            return;
+                        if (verify) // while the new bytes are in the cache
+                            adler = Zlib::adler32(adler, &scanlines[adlerpos],
+                                                  zlib.pos - adlerpos);
+                        adlerpos = zlib.pos;
+                        if (info.interlaceMethod == 0)
+                            unFilterRows(out, scanlines, zlib.pos, y,
+                                         userows ? &rows[0] : 0, converting);
+                        if (error)
+                            return;
+                    }
                     pos += (4 + chunkLength);
                 }
                 else if (in[pos + 0] == 'I' && in[pos + 1] == 'E' &&
@@ -581,70 +1049,20 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
                          in[pos + 2] == 'T' &&
                          in[pos + 3] == 'E') // palette chunk (PLTE)
                 {
-                    pos += 4; // go after the 4 letters
-                    info.palette.resize(4 * (chunkLength / 3));
-                    if (info.palette.size() > (4 * 256))
-                    {
-                        error = 38;
+                    readPalette(&in[pos + 4], chunkLength);
+                    if (error)
                         return;
-                    } // error: palette too big
-                    for (size_t i = 0; i < info.palette.size(); i += 4)
-                    {
-                        for (size_t j           = 0; j < 3; j++)
-                            info.palette[i + j] = in[pos++]; // RGB
-                        info.palette[i + 3]     = 255;       // alpha
-                    }
+                    pos += (4 + chunkLength);
                 }
                 else if (in[pos + 0] == 't' && in[pos + 1] == 'R' &&
                          in[pos + 2] == 'N' &&
                          in[pos + 3] ==
                              'S') // palette transparency chunk (tRNS)
                 {
-                    pos += 4; // go after the 4 letters
-                    if (info.colorType == 3)
-                    {
-                        if (4 * chunkLength > info.palette.size())
-                        {
-                            error = 39;
-                            return;
-                        } // error: more alpha values given than there are
-                          // palette entries
-                        for (size_t i               = 0; i < chunkLength; i++)
-                            info.palette[4 * i + 3] = in[pos++];
-                    }
-                    else if (info.colorType == 0)
-                    {
-                        if (chunkLength != 2)
-                        {
-                            error = 40;
-                            return;
-                        } // error: this chunk must be 2 bytes for greyscale
-                          // image
-                        info.key_defined = 1;
-                        info.key_r = info.key_g = info.key_b =
-                            256 * in[pos] + in[pos + 1];
-                        pos += 2;
-                    }
-                    else if (info.colorType == 2)
-                    {
-                        if (chunkLength != 6)
-                        {
-                            error = 41;
-                            return;
-                        } // error: this chunk must be 6 bytes for RGB image
-                        info.key_defined = 1;
-                        info.key_r       = 256 * in[pos] + in[pos + 1];
-                        pos += 2;
-                        info.key_g = 256 * in[pos] + in[pos + 1];
-                        pos += 2;
-                        info.key_b = 256 * in[pos] + in[pos + 1];
-                        pos += 2;
-                    }
-                    else
-                    {
-                        error = 42;
+                    readTransparency(&in[pos + 4], chunkLength);
+                    if (error)
                         return;
-                    } // error: tRNS chunk not allowed for other color models
+                    pos += (4 + chunkLength);
                 }
                 else // it's not an implemented chunk type, so ignore it: skip
                      // over the data
@@ -662,107 +1080,128 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
                 }
                 pos += 4; // step over CRC (which is ignored)
             }
-            unsigned long              bpp = getBpp(info);
-            std::vector<unsigned char> scanlines(
-                ((info.width * (info.height * bpp + 7)) / 8) +
-                info.height); // now the out buffer will be filled
-            Zlib zlib;        // decompress with the Zlib decompressor
-            error = zlib.decompress(scanlines, idat);
-            if (error)
-                return; // stop if the zlib decompressor returned an error
-            size_t bytewidth = (bpp + 7) / 8,
-                   outlength = (info.height * info.width * bpp + 7) / 8;
-            out.resize(outlength); // time to fill the out buffer
-            unsigned char* out_ =
-                outlength ? &out[0] : 0; // use a regular pointer to the
-                                         // std::vector for faster code if
-                                         // compiled without optimization
-            if (info.interlaceMethod == 0) // no interlace, just filter
-            {
-                size_t linestart  = 0,
-                       linelength = (info.width * bpp + 7) /
-                                    8; // length in bytes of a scanline,
-                                       // excluding the filtertype byte
-                if (bpp >= 8) // byte per byte
-                    for (unsigned long y = 0; y < info.height; y++)
-                    {
-                        unsigned long        filterType = scanlines[linestart];
-                        const unsigned char* prevline =
-                            (y == 0) ? 0
-                                     : &out_[(y - 1) * info.width * bytewidth];
-                        unFilterScanline(&out_[linestart - y],
-                                         &scanlines[linestart + 1], prevline,
-                                         bytewidth, filterType, linelength);
-                        if (error)
-                            return;
-                        linestart +=
-                            (1 + linelength); // go to start of next scanline
-                    }
-                else // less than 8 bits per pixel, so fill it up bit per bit
-                {
-                    std::vector<unsigned char> templine(
-                        (info.width * bpp + 7) >> 3); // only used if bpp < 8
-                    for (size_t y = 0, obp = 0; y < info.height; y++)
-                    {
-                        unsigned long        filterType = scanlines[linestart];
-                        const unsigned char* prevline =
-                            (y == 0) ? 0
-                                     : &out_[(y - 1) * info.width * bytewidth];
-                        unFilterScanline(&templine[0],
-                                         &scanlines[linestart + 1], prevline,
-                                         bytewidth, filterType, linelength);
-                        if (error)
-                            return;
-                        for (size_t bp = 0; bp < info.width * bpp;)
-                            setBitOfReversedStream(
-                                obp, out_,
-                                readBitFromReversedStream(bp, &templine[0]));
-                        linestart +=
-                            (1 + linelength); // go to start of next scanline
-                    }
-                }
-            }
-            else // interlaceMethod is 1 (Adam7)
-            {
-                size_t passw[7] = { (info.width + 7) / 8, (info.width + 3) / 8,
-                                    (info.width + 3) / 4, (info.width + 1) / 4,
-                                    (info.width + 1) / 2, (info.width + 0) / 2,
-                                    (info.width + 0) / 1 };
-                size_t passh[7] = {
-                    (info.height + 7) / 8, (info.height + 7) / 8,
-                    (info.height + 3) / 8, (info.height + 3) / 4,
-                    (info.height + 1) / 4, (info.height + 1) / 2,
-                    (info.height + 0) / 2
-                };
-                size_t passstart[7] = { 0 };
-                size_t pattern[28]  = {
-                    0, 4, 0, 2, 0, 1, 0, 0, 0, 4, 0, 2, 0, 1,
-                    8, 8, 4, 4, 2, 2, 1, 8, 8, 8, 4, 4, 2, 2
-                }; // values for the adam7 passes
-                for (int i           = 0; i < 6; i++)
-                    passstart[i + 1] = passstart[i] +
-                                       passh[i] * ((passw[i] ? 1 : 0) +
-                                                   (passw[i] * bpp + 7) / 8);
-                std::vector<unsigned char> scanlineo((info.width * bpp + 7) /
-                                                     8),
-                    scanlinen((info.width * bpp + 7) /
-                              8); //"old" and "new" scanline
-                for (int i = 0; i < 7; i++)
-                    adam7Pass(&out_[0], &scanlinen[0], &scanlineo[0],
-                              &scanlines[passstart[i]], info.width, pattern[i],
-                              pattern[i + 7], pattern[i + 14], pattern[i + 21],
-                              passw[i], passh[i], bpp);
-            }
-            if (convert_to_rgba32 && (info.colorType != 6 ||
-                                      info.bitDepth != 8)) // conversion needed
+            for (bool done = false; !done;)
             {
-                std::vector<unsigned char> data = out;
-                error = convert(out, &data[0], info, info.width, info.height);
+                if (info.interlaceMethod == 0 && y < info.height)
+                    zlib.outlimit = (y + pipelinerows) * (1 + linelength);
+                else
+                    zlib.outlimit = (size_t)-1;
+                done  = zlib.finish();
+                error = zlib.error;
+                if (error)
+                    return; // stop if the zlib decompressor returned an error
+                if (verify)
+                    adler = Zlib::adler32(adler, &scanlines[adlerpos],
+                                          zlib.pos - adlerpos);
+                adlerpos = zlib.pos;
+                if (info.interlaceMethod == 0)
+                    unFilterRows(out, scanlines, zlib.pos, y,
+                                 userows ? &rows[0] : 0, converting);
+                if (error)
+                    return;
             }
-        }
-        void readPngHeader(const unsigned char* in,
-                           size_t inlength) // read the information from the
-                                            // header and store it in the Info
+            if (zlib.pos != inflatedsize)
+            {
+                error = 91;
+                return;
+            } // error: the image data ends before the last scanline
+            if (verify && adler != adlerstored)
+            {
+                error = 58;
+                return;
+            } // error: the Adler-32 of the inflated data is wrong
+            if (info.interlaceMethod == 0) // no interlace, done with the rows
+                return;
+            size_t passw[7], passh[7], passstart[8]; // interlaceMethod is 1
+            adam7Layout(info.width, info.height, bpp, passw, passh, passstart);
+            unFilterPasses(scanlines, passw, passh, passstart, bpp);
+            rows.resize(linelength + 1);
+            for (y = 0; y < info.height && !error; y++)
+            {
+                adam7Row(&rows[0], scanlines, y, passw, passstart, bpp);
+                storeRow(out, y, &rows[0], converting);
+            }
+        }
+        void unFilterRows(unsigned char* out, const unsigned char* scanlines,
+                          size_t inflated, unsigned long& y,
+                          unsigned char* rows, bool converting)
+        { // unfilter the rows from y on that are inflated in full, into out
+          // or, if they still have to be converted or packed, into the two
+          // rows at rows by turns (not in place, the inflater may still copy
+          // from the filtered ones) and from there to out with storeRow
+            unsigned long bpp       = getBpp(info);
+            size_t        bytewidth = (bpp + 7) / 8,
+                   linelength       = (info.width * bpp + 7) / 8;
+            for (; y < info.height && !error &&
+                   (y + 1) * (1 + linelength) <= inflated;
+                 y++)
+            {
+                const unsigned char* line = &scanlines[y * (1 + linelength)];
+                unsigned char*       prevline = 0;
+                unsigned char*       recon;
+                if (rows)
+                {
+                    recon = rows + (y & 1) * linelength;
+                    if (y)
+                        prevline = rows + ((y - 1) & 1) * linelength;
+                }
+                else
+                {
+                    recon = &out[outRow(y) * linelength];
+                    if (y)
+                        prevline = &out[outRow(y - 1) * linelength];
+                }
+                unFilterScanline(recon, line + 1, prevline, bytewidth, line[0],
+                                 linelength);
+                if (rows && !error)
+                    storeRow(out, y, recon, converting);
+            }
+        }
+        void getSizes(size_t& inflatedsize, size_t& imagesize,
+                      bool convert_to_rgba32) // of the image in info
+        {
+            unsigned long bpp = getBpp(info);
+            size_t        passw[7], passh[7], passstart[8];
+            adam7Layout(info.width, info.height, bpp, passw, passh, passstart);
+            // in size_t, unsigned long may be 32 bits where size_t is 64
+            inflatedsize =
+                info.interlaceMethod
+                    ? passstart[7]
+                    : info.height * (1 + ((size_t)info.width * bpp + 7) / 8);
+            imagesize = convert_to_rgba32
+                            ? (size_t)info.width * info.height * 4
+                            : ((size_t)info.height * info.width * bpp + 7) / 8;
+        }
+        void storeRow(unsigned char* out, unsigned long y,
+                      const unsigned char* row, bool converting)
+        { // put unfiltered scanline y in its place in out, converting it or
+          // packing its pixels without padding when they're under 8 bits
+            unsigned long bpp = getBpp(info);
+            size_t        linelength = (info.width * bpp + 7) / 8;
+            if (converting)
+                error = convert(&out[outRow(y) * info.width * 4], row, info,
+                                info.width, 1);
+            else if (bpp >= 8)
+                std::copy(row, row + linelength, &out[outRow(y) * linelength]);
+            else // or the bits in a byte at a time, shifted to where they go
+            {
+                size_t         nbits = info.width * bpp,
+                       obp           = outRow(y) * nbits;
+                unsigned int   shift = obp & 0x7;
+                unsigned char* o     = &out[obp >> 3];
+                for (size_t i = 0; i * 8 < nbits; i++)
+                {
+                    size_t       n = nbits - i * 8 < 8 ? nbits - i * 8 : 8;
+                    unsigned int b = row[i] & (0xFF00 >> n); // no padding
+                    o[i] |= (unsigned char)(b >> shift);
+                    if (shift + n > 8)
+                        o[i + 1] |= (unsigned char)(b << (8 - shift));
+                }
+            }
+        }
+        void readPngHeader(const unsigned char* in,
+                           size_t inlength) // read the information from the
+                                            // header and store it in the Info
         {
             if (inlength < 29)
             {
@@ -781,6 +1220,16 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
                 error = 29;
                 return;
             } // error: it doesn't start with a IHDR chunk!
+            if (verify && (inlength < 33 || read32bitInt(&in[8]) != 13))
+            {
+                error = inlength < 33 ? 27 : 94;
+                return;
+            } // error: the IHDR chunk is cut short or not 13 bytes long
+            if (verify && crc32(0, &in[12], 17) != read32bitInt(&in[29]))
+            {
+                error = 57;
+                return;
+            } // error: the CRC of the IHDR chunk is wrong
             info.width             = read32bitInt(&in[16]);
             info.height            = read32bitInt(&in[20]);
             info.bitDepth          = in[24];
@@ -806,12 +1255,106 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
             } // error: only interlace methods 0 and 1 exist in the
               // specification
             error = checkColorValidity(info.colorType, info.bitDepth);
+            if (error)
+                return;
+            if (info.width == 0 || info.height == 0 ||
+                info.width > 0x7FFFFFFFUL || info.height > 0x7FFFFFFFUL)
+            {
+                error = 93;
+                return;
+            } // error: the specification allows 1 to 2^31 - 1 pixels a side
+            // no buffer size is over height * (8 * width + 4) bytes: 8 bytes
+            // a pixel at 64 bits or in RGBA, and the filter byte and padding
+            // of fewer than 2 rows a row with Adam7, with 64 bytes to spare
+            // for the slack of the inflater. A size that wrapped around could
+            // pass a caller's buffer that is too small as large enough
+            const size_t maxsize = (size_t)-1 - 64;
+            if (info.width > (maxsize - 4) / 8 ||
+                info.height > maxsize / (8 * (size_t)info.width + 4))
+            {
+                error = 92;
+                return;
+            } // error: the buffer sizes of the image don't fit in a size_t
+        }
+        void readPalette(const unsigned char* data, size_t length) // PLTE
+        {
+            info.palette.resize(4 * (length / 3));
+            if (info.palette.size() > (4 * 256))
+            {
+                error = 38;
+                return;
+            } // error: palette too big
+            for (size_t i = 0, pos = 0; i < info.palette.size(); i += 4)
+            {
+                for (size_t j           = 0; j < 3; j++)
+                    info.palette[i + j] = data[pos++]; // RGB
+                info.palette[i + 3]     = 255;         // alpha
+            }
+        }
+        void readTransparency(const unsigned char* data, size_t length) // tRNS
+        {
+            if (info.colorType == 3)
+            {
+                if (4 * length > info.palette.size())
+                {
+                    error = 39;
+                    return;
+                } // error: more alpha values given than there are palette
+                  // entries
+                for (size_t i               = 0; i < length; i++)
+                    info.palette[4 * i + 3] = data[i];
+            }
+            else if (info.colorType == 0)
+            {
+                if (length != 2)
+                {
+                    error = 40;
+                    return;
+                } // error: this chunk must be 2 bytes for greyscale image
+                info.key_defined = 1;
+                info.key_r = info.key_g = info.key_b = 256 * data[0] + data[1];
+            }
+            else if (info.colorType == 2)
+            {
+                if (length != 6)
+                {
+                    error = 41;
+                    return;
+                } // error: this chunk must be 6 bytes for RGB image
+                info.key_defined = 1;
+                info.key_r       = 256 * data[0] + data[1];
+                info.key_g       = 256 * data[2] + data[3];
+                info.key_b       = 256 * data[4] + data[5];
+            }
+            else
+            {
+                error = 42;
+                return;
+            } // error: tRNS chunk not allowed for other color models
         }
         void unFilterScanline(unsigned char*       recon,
                               const unsigned char* scanline,
                               const unsigned char* precon, size_t bytewidth,
                               unsigned long filterType, size_t length)
         {
+            // vectorized kernels where the CPU has them, the loops below are
+            // the reference and handle the first scanline
+            const picopng::UnfilterKernels& simd = picopng::unfilterKernels();
+            picopng::UnfilterKernel kernel       = 0;
+            bool pixelwise = (bytewidth == 3 || bytewidth == 4);
+            if (filterType == 1 && pixelwise)
+                kernel = simd.sub;
+            else if (filterType == 2 && precon)
+                kernel = simd.up;
+            else if (filterType == 3 && precon && pixelwise)
+                kernel = simd.avg;
+            else if (filterType == 4 && precon && pixelwise)
+                kernel = simd.paeth;
+            if (kernel)
+            {
+                kernel(recon, scanline, precon, bytewidth, length);
+                return;
+            }
             switch (filterType)
             {
                 case 0:
@@ -876,51 +1419,92 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
                     return; // error: unexisting filter type given
             }
         }
-        void adam7Pass(unsigned char* out, unsigned char* linen,
-                       unsigned char* lineo, const unsigned char* in,
-                       unsigned long w, size_t passleft, size_t passtop,
-                       size_t spacex, size_t spacey, size_t passw, size_t passh,
-                       unsigned long bpp)
-        { // filter and reposition the pixels into the output when the image is
-          // Adam7 interlaced. This function can only do it after the full image
-          // is already decoded. The out buffer must have the correct allocated
-          // memory size already.
-            if (passw == 0)
+        static void adam7Layout(unsigned long w, unsigned long h,
+                                unsigned long bpp, size_t passw[7],
+                                size_t passh[7], size_t passstart[8])
+        { // the size of each Adam7 pass and where its filtered scanlines start
+          // in the inflated data, passstart[7] is the size of all of it
+            size_t pw[7] = { (w + 7) / 8, (w + 3) / 8, (w + 3) / 4,
+                             (w + 1) / 4, (w + 1) / 2, (w + 0) / 2,
+                             (w + 0) / 1 };
+            size_t ph[7] = { (h + 7) / 8, (h + 7) / 8, (h + 3) / 8,
+                             (h + 3) / 4, (h + 1) / 4, (h + 1) / 2,
+                             (h + 0) / 2 };
+            passstart[0] = 0;
+            for (int i = 0; i < 7; i++)
+            {
+                passw[i]         = pw[i];
+                passh[i]         = ph[i];
+                passstart[i + 1] = passstart[i] +
+                                   passh[i] * ((passw[i] ? 1 : 0) +
+                                               (passw[i] * bpp + 7) / 8);
+            }
+        }
+        void unFilterPasses(unsigned char* scanlines, const size_t passw[7],
+                            const size_t passh[7], const size_t passstart[8],
+                            unsigned long bpp)
+        { // unfilter the scanlines of all Adam7 passes in place, the image is
+          // only known once all of them are decoded
+            for (int i = 0; i < 7 && !error; i++)
+                unFilterPass(scanlines, i, passw, passh, passstart, bpp);
+        }
+        void unFilterPass(unsigned char* scanlines, int i,
+                          const size_t passw[7], const size_t passh[7],
+                          const size_t passstart[8], unsigned long bpp)
+        { // unfilter the scanlines of Adam7 pass i in place
+            if (passw[i] == 0)
                 return;
-            size_t bytewidth  = (bpp + 7) / 8,
-                   linelength = 1 + ((bpp * passw + 7) / 8);
-            for (unsigned long y = 0; y < passh; y++)
-            {
-                unsigned char filterType = in[y * linelength],
-                              *prevline  = (y == 0) ? 0 : lineo;
-                unFilterScanline(linen, &in[y * linelength + 1], prevline,
-                                 bytewidth, filterType, (w * bpp + 7) / 8);
+            size_t bytewidth = (bpp + 7) / 8;
+            size_t linelength = 1 + ((bpp * passw[i] + 7) / 8);
+            const unsigned char* prevline = 0;
+            for (unsigned long y = 0; y < passh[i]; y++)
+            {
+                unsigned char* line = &scanlines[passstart[i] + y * linelength];
+                unFilterScanline(line + 1, line + 1, prevline, bytewidth,
+                                 line[0], linelength - 1);
                 if (error)
                     return;
+                prevline = line + 1;
+            }
+        }
+        void adam7Row(unsigned char* row, const unsigned char* scanlines,
+                      unsigned long y, const size_t passw[7],
+                      const size_t passstart[8], unsigned long bpp)
+        { // gather the pixels of row y from the unfiltered passes that have
+          // them
+            size_t bytewidth = (bpp + 7) / 8;
+            if (bpp < 8) // the pixels are or'ed in bit by bit
+                std::fill(row, row + (info.width * bpp + 7) / 8, 0);
+            for (int i = 0; i < 7; i++)
+            {
+                size_t top = ADAM7[i + 7], spacey = ADAM7[i + 21];
+                if (passw[i] == 0 || y < top || (y - top) % spacey != 0)
+                    continue;
+                size_t linelength = 1 + ((bpp * passw[i] + 7) / 8);
+                const unsigned char* line =
+                    &scanlines[passstart[i] + (y - top) / spacey * linelength +
+                               1];
+                size_t left = ADAM7[i], spacex = ADAM7[i + 14];
                 if (bpp >= 8)
-                    for (size_t i = 0; i < passw; i++)
+                    for (size_t k = 0; k < passw[i]; k++)
                         for (size_t b = 0; b < bytewidth;
                              b++) // b = current byte of this pixel
-                            out[bytewidth * w * (passtop + spacey * y) +
-                                bytewidth * (passleft + spacex * i) + b] =
-                                linen[bytewidth * i + b];
+                            row[bytewidth * (left + spacex * k) + b] =
+                                line[bytewidth * k + b];
                 else
-                    for (size_t i = 0; i < passw; i++)
+                    for (size_t k = 0; k < passw[i]; k++)
                     {
-                        size_t obp = bpp * w * (passtop + spacey * y) +
-                                     bpp * (passleft + spacex * i),
-                               bp = i * bpp;
+                        size_t obp = bpp * (left + spacex * k), bp = bpp * k;
                         for (size_t b = 0; b < bpp; b++)
                             setBitOfReversedStream(
-                                obp, out,
-                                readBitFromReversedStream(bp, &linen[0]));
+                                obp, row, readBitFromReversedStream(bp, line));
                     }
-                unsigned char* temp = linen;
-                linen               = lineo;
-                lineo               = temp; // swap the two buffer pointers "line old" and
-                              // "line new"
             }
         }
+        size_t outRow(size_t y) const // where scanline y goes in the output
+        {
+            return bottomUp ? info.height - 1 - y : y;
+        }
         static unsigned long readBitFromReversedStream(
             size_t& bitp, const unsigned char* bits)
         {
@@ -930,10 +1514,11 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
         }
         static unsigned long readBitsFromReversedStream(
             size_t& bitp, const unsigned char* bits, unsigned long nbits)
-        {
-            unsigned long result = 0;
-            for (size_t i = nbits - 1; i < nbits; i--)
-                result += ((readBitFromReversedStream(bitp, bits)) << i);
+        { // nbits is a bit depth under 8, so the bits are all in one byte
+            unsigned long result =
+                (bits[bitp >> 3] >> (8 - nbits - (bitp & 0x7))) &
+                ((1U << nbits) - 1);
+            bitp += nbits;
             return result;
         }
         void setBitOfReversedStream(size_t& bitp, unsigned char* bits,
@@ -944,8 +1529,52 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
         }
         unsigned long read32bitInt(const unsigned char* buffer)
         {
-            return (buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) |
-                   buffer[3];
+            return ((unsigned long)buffer[0] << 24) | (buffer[1] << 16) |
+                   (buffer[2] << 8) | buffer[3];
+        }
+        struct Crc32Tables // slice-by-8: entry i of table k is the CRC of
+        {                  // byte i followed by k zero bytes
+            unsigned long t[8][256];
+            Crc32Tables()
+            {
+                for (unsigned long i = 0; i < 256; i++)
+                {
+                    unsigned long c = i;
+                    for (int k = 0; k < 8; k++)
+                        c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+                    t[0][i] = c;
+                }
+                for (unsigned long i = 0; i < 256; i++)
+                    for (int k = 1; k < 8; k++)
+                        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 255];
+            }
+        };
+        static unsigned long crc32(unsigned long crc, const unsigned char* data,
+                                   size_t size)
+        { // adds size bytes to the CRC crc, which starts out as 0
+            if (checksumKernels().crc32 && size >= 64)
+            {
+                size_t n = size & ~(size_t)15; // the rest below
+                crc      = checksumKernels().crc32(crc, data, n);
+                data += n;
+                size -= n;
+            }
+            static const Crc32Tables tables; // built once, on first use
+            const unsigned long(*t)[256] = tables.t;
+            crc = ~crc & 0xFFFFFFFFUL;
+            for (; size >= 8; size -= 8, data += 8) // 8 bytes per step
+            {
+                unsigned long lo = crc ^ (data[0] | data[1] << 8 |
+                                          data[2] << 16 |
+                                          (unsigned long)data[3] << 24);
+                crc = t[7][lo & 255] ^ t[6][(lo >> 8) & 255] ^
+                      t[5][(lo >> 16) & 255] ^ t[4][lo >> 24] ^
+                      t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^
+                      t[0][data[7]];
+            }
+            for (; size > 0; size--)
+                crc = t[0][(crc ^ *data++) & 255] ^ (crc >> 8);
+            return ~crc & 0xFFFFFFFFUL;
         }
         int checkColorValidity(
             unsigned long colorType,
@@ -984,16 +1613,44 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
             else
                 return info.bitDepth;
         }
-        int convert(std::vector<unsigned char>& out, const unsigned char* in,
-                    Info& infoIn, unsigned long w, unsigned long h)
-        { // converts from any color type to 32-bit. return value = LodePNG
-          // error code
+        static bool convertWithKernel(unsigned char* out,
+                                      const unsigned char* in,
+                                      const Info& infoIn, size_t numpixels)
+        { // convert 8-bit pixels with a SIMD kernel, if the CPU has one
+            const picopng::ConvertKernels& simd = picopng::convertKernels();
+            bool key = infoIn.key_defined && infoIn.key_r < 256 &&
+                       (infoIn.colorType == 0 ||
+                        (infoIn.key_g < 256 && infoIn.key_b < 256));
+            // a key out of 8-bit range never matches, so it is ignored
+            if (infoIn.colorType == 0 && key && simd.greyKey)
+                simd.greyKey(out, in, numpixels, (unsigned int)infoIn.key_r);
+            else if (infoIn.colorType == 0 && !key && simd.grey)
+                simd.grey(out, in, numpixels);
+            else if (infoIn.colorType == 2 && key && simd.rgbKey)
+                simd.rgbKey(out, in, numpixels,
+                            (unsigned int)(infoIn.key_r | infoIn.key_g << 8 |
+                                           infoIn.key_b << 16));
+            else if (infoIn.colorType == 2 && !key && simd.rgb)
+                simd.rgb(out, in, numpixels);
+            else if (infoIn.colorType == 3 && simd.palette)
+                return simd.palette(out, in, numpixels,
+                                    infoIn.palette.empty() ? 0
+                                                           : &infoIn.palette[0],
+                                    infoIn.palette.size());
+            else if (infoIn.colorType == 4 && simd.greyAlpha)
+                simd.greyAlpha(out, in, numpixels);
+            else
+                return false;
+            return true;
+        }
+        int convert(unsigned char* out_, const unsigned char* in,
+                    const Info& infoIn, unsigned long w, unsigned long h)
+        { // converts from any color type to 32-bit into w * h * 4 bytes at
+          // out_. return value = LodePNG error code
             size_t numpixels = w * h, bp = 0;
-            out.resize(numpixels * 4);
-            unsigned char* out_ =
-                out.empty()
-                    ? 0
-                    : &out[0]; // faster if compiled without optimization
+            if (infoIn.bitDepth == 8 &&
+                convertWithKernel(out_, in, infoIn, numpixels))
+                return 0; // done by a SIMD kernel
             if (infoIn.bitDepth == 8 && infoIn.colorType == 0) // greyscale
                 for (size_t i = 0; i < numpixels; i++)
                 {
@@ -1019,10 +1676,8 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
                 {
                     if (4U * in[i] >= infoIn.palette.size())
                         return 46;
-                    for (size_t c = 0; c < 4; c++)
-                        out_[4 * i + c] =
-                            infoIn.palette[4 * in[i] + c]; // get rgb colors
-                                                           // from the palette
+                    std::memcpy(&out_[4 * i], &infoIn.palette[4 * in[i]],
+                                4); // get rgba colors from the palette
                 }
             else if (infoIn.bitDepth == 8 &&
                      infoIn.colorType == 4) // greyscale with alpha
@@ -1042,7 +1697,8 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
                     out_[4 * i + 0] = out_[4 * i + 1] = out_[4 * i + 2] =
                         in[2 * i];
                     out_[4 * i + 3] = (infoIn.key_defined &&
-                                       256U * in[i] + in[i + 1] == infoIn.key_r)
+                                       256U * in[2 * i] + in[2 * i + 1] ==
+                                           infoIn.key_r)
                                           ? 0
                                           : 255;
                 }
@@ -1075,19 +1731,16 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
             else if (infoIn.bitDepth < 8 && infoIn.colorType == 0) // greyscale
                 for (size_t i = 0; i < numpixels; i++)
                 {
+                    unsigned long sample =
+                        readBitsFromReversedStream(bp, in, infoIn.bitDepth);
                     unsigned long value =
-                        (readBitsFromReversedStream(bp, in, infoIn.bitDepth) *
-                         255) /
-                        ((1 << infoIn.bitDepth) -
-                         1); // scale value from 0 to 255
+                        sample * (255 / ((1 << infoIn.bitDepth) -
+                                         1)); // scale value from 0 to 255
                     out_[4 * i + 0] = out_[4 * i + 1] = out_[4 * i + 2] =
                         (unsigned char)(value);
                     out_[4 * i + 3] =
-                        (infoIn.key_defined && value &&
-                         ((1U << infoIn.bitDepth) - 1U) == infoIn.key_r &&
-                         ((1U << infoIn.bitDepth) - 1U))
-                            ? 0
-                            : 255;
+                        (infoIn.key_defined && sample == infoIn.key_r) ? 0
+                                                                       : 255;
                 }
             else if (infoIn.bitDepth < 8 && infoIn.colorType == 3) // palette
                 for (size_t i = 0; i < numpixels; i++)
@@ -1114,13 +1767,806 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
                                                           : pb <= pc ? b : c);
         }
     };
-    PNG decoder;
-    decoder.decode(out_image, in_png, in_size, convert_to_rgba32);
+    class StreamDecoder
+    {
+        // Push style PNG decoder for data that arrives a piece at a time. The
+        // bytes given to feed() are split into chunks as they come, with the
+        // contents of the IDAT chunks queued for the inflator, and
+        // poll_rows() inflates just enough of them to unfilter the next rows.
+        // Of the inflated data only the 32k sliding window and the rows not
+        // polled yet are kept, so a large texture needs far less memory than
+        // decodePNG, which holds all of the inflated data next to the image.
+        // An Adam7 interlaced image is only known once all of its passes are
+        // there, so it is inflated whole and its rows come after IEND. Its
+        // passes can be had before that with poll_pass(), for a blocky image
+        // that is refined as the data comes in.
+        //
+        // Rows are row_bytes() long: 32-bit RGBA when convert_to_rgba32 is
+        // set, otherwise the raw PNG pixels, each row starting at a byte
+        // boundary (unlike decodePNG, which packs sub-byte pixels).
+        //
+        // With verify_checksums, a wrong chunk CRC is error 57 as soon as the
+        // chunk is in, a wrong Adler-32 error 58 once IEND is in and all rows
+        // have been polled; rows polled before may be corrupt. finished()
+        // then also waits for IEND.
+
+    public:
+        explicit StreamDecoder(bool convert_to_rgba32 = true,
+                               bool verify_checksums  = false)
+            : convert(convert_to_rgba32), verify(verify_checksums)
+        {
+            png.verify           = verify;
+            png.error            = 0;
+            png.info.width       = png.info.height = 0;
+            png.info.key_defined = false;
+        }
+        // Consumes all size bytes of the PNG data, returns an error code
+        int feed(const unsigned char* data, size_t size)
+        {
+            for (size_t pos = 0; pos < size && !png.error && state != END;)
+            {
+                size_t n = size - pos;
+                if (state == CHUNKDATA)
+                {
+                    if (n > chunkleft)
+                        n = chunkleft;
+                    if (verify)
+                        crc = PNG::crc32(crc, &data[pos], n);
+                    if (idat && verify)
+                        for (size_t i = n > 4 ? n - 4 : 0; i < n; i++)
+                            adlerstored = (adlerstored << 8 | data[pos + i]) &
+                                          0xFFFFFFFFUL; // ends the zlib data
+                    if (idat)
+                        zdata.insert(zdata.end(), &data[pos], &data[pos + n]);
+                    else if (keep)
+                        chunk.insert(chunk.end(), &data[pos], &data[pos + n]);
+                    chunkleft -= n;
+                    pos += n;
+                    if (chunkleft == 0)
+                        nextState();
+                    continue;
+                }
+                if (n > want - have)
+                    n = want - have;
+                for (size_t i = 0; i < n; i++)
+                    head[have++] = data[pos++];
+                if (have == want)
+                    nextState();
+            }
+            return png.error;
+        }
+        // Writes up to maxrows finished rows to out, row_bytes() apart, and
+        // returns how many. Fewer rows means more data has to be fed first,
+        // unless finished() or error() says there's nothing more to come
+        size_t poll_rows(unsigned char* out, size_t maxrows)
+        {
+            size_t n = 0;
+            while (n < maxrows && !png.error && y < png.info.height &&
+                   headerdone)
+            {
+                if (!rowReady())
+                {
+                    inflateMore();
+                    if (png.error || !rowReady())
+                        break;
+                }
+                emitRow(out + n * row_bytes());
+                n++;
+            }
+            inflateRest();
+            return n;
+        }
+        // For an Adam7 image: writes the next pass, once all of it is in, to
+        // image, which holds info().height rows of row_bytes(), top or with
+        // bottom_up bottom row first. Every pixel of the pass also fills the
+        // pixels right of and below it that only later passes have, so image
+        // shows the whole picture at the resolution the passes so far give.
+        // Returns the number of the pass written, 1 to 7, or 0 if more data
+        // has to be fed first (or the image is not interlaced, or all passes
+        // have been written). Once pass 7 is written image is complete and
+        // all rows count as polled.
+        unsigned int poll_pass(unsigned char* image, bool bottom_up = false)
+        {
+            if (!headerdone || png.error || !png.info.interlaceMethod ||
+                passespolled == 7)
+                return 0;
+            if (passespolled == passesready)
+                inflateMore();
+            if (png.error || passespolled == passesready)
+                return 0;
+            storePass(image, passespolled, bottom_up);
+            if (png.error)
+                return 0;
+            if (++passespolled == 7)
+                y = png.info.height; // the rows are all in image
+            inflateRest();
+            return passespolled;
+        }
+        bool header_ready() const // are info and row_bytes() known yet?
+        {
+            return headerdone;
+        }
+        const PNG::Info& info() const
+        {
+            return png.info;
+        }
+        size_t row_bytes() const
+        {
+            return convert ? png.info.width * 4 : linebytes;
+        }
+        unsigned long rows_polled() const
+        {
+            return y;
+        }
+        bool finished() const // all rows have been polled, and checked
+        {                     // up to IEND with verify_checksums
+            return headerdone && y == png.info.height &&
+                   (!verify || (state == END &&
+                                inflator.state == Zlib::Inflator::DONE));
+        }
+        int error() const
+        {
+            return png.error;
+        }
+
+    private:
+        enum
+        {
+            SIGNATURE, // the signature and the IHDR chunk, 33 bytes
+            CHUNKHEAD, // length and type of the next chunk
+            CHUNKDATA, // the data of a chunk
+            CHUNKCRC,  // the CRC of a chunk, checked if verify is set
+            END        // IEND has been read
+        };
+        PNG                        png; // header, palette and the filters
+        bool                       convert;
+        bool                       verify;
+        unsigned long              crc = 0; // of the current chunk so far
+        unsigned long adler = 1, adlerstored = 0; // computed and given
+        int                        state = SIGNATURE;
+        unsigned char              head[33];      // fixed size parts
+        size_t                     have = 0, want = 33;
+        size_t                     chunkleft = 0; // data bytes still to come
+        bool                       idat = false, keep = false, iend = false;
+        unsigned char              type[4];      // of the current chunk
+        std::vector<unsigned char> chunk;        // PLTE or tRNS data
+        std::vector<unsigned char> zdata;        // zlib data not inflated
+        size_t                     zused = 0;    // whole bytes of it used
+        unsigned int               zbits = 0;    // and bits of the next one
+        bool                       zheader = false; // zlib header checked?
+        Zlib::Inflator             inflator;
+        std::vector<unsigned char> window; // inflated, from winstart on
+        size_t                     winpos = 0;   // bytes in window
+        size_t                     rowstart = 0; // next row in window
+        bool                       headerdone = false;
+        unsigned long              bpp = 0, y = 0;
+        size_t                     bytewidth = 0, linebytes = 0;
+        std::vector<unsigned char> row, prevrow; // unfiltered rows
+        bool                       deinterlaced = false; // Adam7 passes
+        size_t                     passw[7], passh[7], passstart[8];
+        unsigned int               passesready  = 0; // unfiltered in window
+        unsigned int               passespolled = 0; // by poll_pass
+        std::vector<unsigned char> passrow; // a pass row converted to RGBA
+        void nextState()
+        {
+            if (state == SIGNATURE)
+            {
+                png.readPngHeader(head, 33);
+                if (png.error)
+                    return;
+                bpp       = png.getBpp(png.info);
+                bytewidth = (bpp + 7) / 8;
+                linebytes = (png.info.width * bpp + 7) / 8;
+                row.resize(linebytes);
+                prevrow.resize(linebytes);
+                if (png.info.interlaceMethod)
+                    png.adam7Layout(png.info.width, png.info.height, bpp,
+                                    passw, passh, passstart);
+                headerdone = true;
+                inflator.reset(true);
+                inflator.setOutput(window);
+                state = CHUNKHEAD;
+                have  = 0;
+                want  = 8;
+            }
+            else if (state == CHUNKHEAD)
+            {
+                chunkleft = png.read32bitInt(head);
+                if (chunkleft > 2147483647)
+                {
+                    png.error = 63;
+                    return;
+                }
+                for (int i  = 0; i < 4; i++)
+                    type[i] = head[4 + i];
+                crc  = PNG::crc32(0, type, 4);
+                idat = isType("IDAT");
+                iend = isType("IEND");
+                keep = isType("PLTE") || isType("tRNS");
+                if (!idat && !iend && !keep && !(type[0] & 32))
+                {
+                    png.error = 69;
+                    return;
+                } // error: unknown critical chunk (5th bit of first byte of
+                  // chunk type is 0)
+                chunk.clear();
+                state = chunkleft ? CHUNKDATA : CHUNKCRC;
+                have  = 0;
+                want  = 4;
+            }
+            else if (state == CHUNKDATA)
+                state = CHUNKCRC;
+            else // CHUNKCRC
+            {
+                if (verify && crc != png.read32bitInt(head))
+                {
+                    png.error = 57;
+                    return;
+                } // error: the CRC of the chunk is wrong
+                const unsigned char* data = chunk.empty() ? 0 : &chunk[0];
+                if (isType("PLTE"))
+                    png.readPalette(data, chunk.size());
+                else if (isType("tRNS"))
+                    png.readTransparency(data, chunk.size());
+                state = iend ? END : CHUNKHEAD;
+                have  = 0;
+                want  = 8;
+                if (iend)
+                {
+                    inflator.streaming = false; // no more data to wait for
+                    checkAdler();
+                    inflateRest();
+                }
+            }
+        }
+        bool isType(const char* name) const
+        {
+            return type[0] == name[0] && type[1] == name[1] &&
+                   type[2] == name[2] && type[3] == name[3];
+        }
+        size_t rowSize() const // of a filtered row in the inflated data
+        {
+            return 1 + linebytes;
+        }
+        bool rowReady() const
+        {
+            if (png.info.interlaceMethod)
+                return deinterlaced;
+            return winpos - rowstart >= rowSize();
+        }
+        void inflateMore() // inflate at least one more row, if there's data
+        {
+            if (!zheader)
+            {
+                if (zdata.size() < 2)
+                {
+                    if (state == END)
+                        png.error = 53;
+                    return;
+                } // error, size of zlib data too small
+                png.error = Zlib::checkHeader(&zdata[0]);
+                zused     = 2;
+                zheader   = true;
+                if (png.error)
+                    return;
+            }
+            size_t outlimit;
+            if (png.info.interlaceMethod) // everything, the window is not
+                outlimit = (size_t)-1;    // slid for Adam7
+            else
+            {
+                size_t drop = winpos > 32768 ? winpos - 32768 : 0;
+                if (drop > rowstart)
+                    drop = rowstart;
+                if (drop >= 32768) // slide the window
+                {
+                    std::copy(window.begin() + drop, window.begin() + winpos,
+                              window.begin());
+                    winpos -= drop;
+                    rowstart -= drop;
+                }
+                outlimit = rowstart + rowSize();
+            }
+            runInflator(outlimit);
+            if (png.info.interlaceMethod && !png.error)
+                unFilterReadyPasses();
+            if (png.error || inflator.state != Zlib::Inflator::DONE)
+                return;
+            checkAdler();
+            if (png.error)
+                return;
+            if (png.info.interlaceMethod)
+                deinterlace();
+            else if (!rowReady())
+                png.error = 91; // error: the image data ends before the last
+                                // row
+        }
+        void runInflator(size_t outlimit) // on the zlib data fed so far
+        {
+            Zlib::BitReader br;
+            br.init(zdata.data() + zused, zdata.size() - zused);
+            if (zbits && br.has(zbits)) // the end of a partly used byte
+                br.consume(zbits);
+            size_t start = winpos;
+            inflator.run(br, winpos, outlimit);
+            if (verify)
+                adler = Zlib::adler32(adler, window.data() + start,
+                                      winpos - start);
+            size_t used = br.pos * 8 - br.count; // bits of zdata used
+            zused += used / 8;
+            zbits = (unsigned int)(used % 8);
+            if (zused >= 4096 && zused * 2 >= zdata.size())
+            {
+                zdata.erase(zdata.begin(), zdata.begin() + zused);
+                zused = 0;
+            }
+            png.error = inflator.error;
+        }
+        void inflateRest()
+        { // rows stop being inflated after the last one, so the end of the
+          // zlib stream is only inflated here, for its Adler-32 to be checked
+            if (!verify || png.error || !headerdone || y < png.info.height ||
+                state != END || !zheader ||
+                inflator.state == Zlib::Inflator::DONE)
+                return;
+            runInflator((size_t)-1);
+            checkAdler();
+        }
+        void checkAdler() // once the zlib stream and IDAT have both ended
+        {
+            if (verify && !png.error && state == END &&
+                inflator.state == Zlib::Inflator::DONE && adler != adlerstored)
+                png.error = 58; // error: the Adler-32 of the inflated data is
+                                // wrong
+        }
+        void deinterlace() // once the inflator is done
+        {
+            if (winpos < passstart[7])
+            {
+                png.error = 91;
+                return;
+            } // error: the image data ends before the last row
+            unFilterReadyPasses();
+            deinterlaced = !png.error;
+        }
+        void unFilterReadyPasses()
+        { // unfilter in place the passes that are inflated in full, and until
+          // the inflator is done, more than 32k back where no match can copy
+          // the filtered bytes from anymore
+            bool done = inflator.state == Zlib::Inflator::DONE;
+            while (passesready < 7 && !png.error &&
+                   passstart[passesready + 1] <= winpos &&
+                   (done || winpos - passstart[passesready + 1] >= 32768))
+                png.unFilterPass(&window[0], passesready++, passw, passh,
+                                 passstart, bpp);
+        }
+        void storePass(unsigned char* image, unsigned int i, bool bottom_up)
+        { // each pixel of pass i fills its block, up to the next pixel of the
+          // pass to the right and below; the earlier passes have blocks of
+          // whole multiples of that, so the rows of a block are all alike
+            if (passw[i] == 0)
+                return;
+            const size_t   left = ADAM7[i], top = ADAM7[i + 7],
+                         spacex = ADAM7[i + 14], spacey = ADAM7[i + 21];
+            const size_t blockw = left ? left : spacex,
+                         blockh = top ? top : spacey;
+            const size_t linelength = (passw[i] * bpp + 7) / 8,
+                         rowbytes   = row_bytes();
+            const size_t pixelbytes = convert ? 4 : bytewidth;
+            const unsigned long width = png.info.width,
+                                height = png.info.height;
+            if (convert)
+                passrow.resize(passw[i] * 4);
+            for (size_t r = 0; r < passh[i]; r++)
+            {
+                const unsigned char* pixels =
+                    &window[passstart[i] + r * (1 + linelength) + 1];
+                if (convert)
+                {
+                    png.error = png.convert(&passrow[0], pixels, png.info,
+                                            passw[i], 1);
+                    if (png.error)
+                        return;
+                    pixels = &passrow[0];
+                }
+                size_t y0 = top + r * spacey, y1 = y0 + blockh;
+                if (y1 > height)
+                    y1 = height;
+                unsigned char* first =
+                    image + (bottom_up ? height - 1 - y0 : y0) * rowbytes;
+                for (size_t k = 0; k < passw[i]; k++)
+                {
+                    size_t x0 = left + k * spacex, x1 = x0 + blockw;
+                    if (x1 > width)
+                        x1 = width;
+                    if (convert || bpp >= 8)
+                        for (size_t x = x0; x < x1; x++)
+                            std::memcpy(first + x * pixelbytes,
+                                        pixels + k * pixelbytes, pixelbytes);
+                    else // sub-byte pixels, bits replaced one pixel at a time
+                    {
+                        size_t        bitp  = k * bpp;
+                        unsigned long value =
+                            PNG::readBitsFromReversedStream(bitp, pixels, bpp);
+                        for (size_t x = x0; x < x1; x++)
+                        {
+                            size_t shift = 8 - bpp - (x * bpp) % 8;
+                            unsigned char& byte = first[x * bpp / 8];
+                            byte = (unsigned char)((byte &
+                                                    ~(((1U << bpp) - 1)
+                                                      << shift)) |
+                                                   (value << shift));
+                        }
+                    }
+                }
+                for (size_t y = y0 + 1; y < y1; y++)
+                    std::memcpy(image + (bottom_up ? height - 1 - y : y) *
+                                            rowbytes,
+                                first, rowbytes);
+            }
+        }
+        void emitRow(unsigned char* out)
+        {
+            const unsigned char* pixels;
+            if (png.info.interlaceMethod)
+            {
+                png.adam7Row(row.data(), &window[0], y, passw, passstart, bpp);
+                pixels = row.data();
+            }
+            else
+            {
+                png.unFilterScanline(row.data(), &window[rowstart + 1],
+                                     y ? prevrow.data() : 0, bytewidth,
+                                     window[rowstart], linebytes);
+                if (png.error)
+                    return;
+                rowstart += rowSize();
+                row.swap(prevrow);
+                pixels = prevrow.data();
+            }
+            if (convert)
+                png.error =
+                    png.convert(out, pixels, png.info, png.info.width, 1);
+            else
+                std::copy(pixels, pixels + linebytes, out);
+            y++;
+        }
+    };
+    struct Probe // what probePNG tells of a PNG without decoding it
+    {
+        unsigned long width = 0, height = 0, colorType = 0, bitDepth = 0;
+        unsigned long interlaceMethod = 0;
+        unsigned long paletteSize     = 0;     // colors in the PLTE chunk
+        bool          transparency    = false; // there is a tRNS chunk
+        unsigned int  channels = 0; // bytes per pixel of decodePNGChannels
+    };
+    // reads the header and then only the length and type of the chunks up to
+    // the first IDAT, the sizes of PLTE and tRNS are all that is needed of
+    // them. read(pos, buffer, size) copies what there is of size bytes from
+    // pos of the file into buffer and gives how many
+    template <typename Read> int probeChunks(Read read, Probe& probe)
+    {
+        unsigned char head[33];
+        PNG           png;
+        png.error = 0;
+        png.readPngHeader(head, read(0, head, 33));
+        if (png.error)
+            return png.error;
+        probe.width           = png.info.width;
+        probe.height          = png.info.height;
+        probe.colorType       = png.info.colorType;
+        probe.bitDepth        = png.info.bitDepth;
+        probe.interlaceMethod = png.info.interlaceMethod;
+        probe.paletteSize     = 0;
+        probe.transparency    = false;
+        for (unsigned long long pos = 33;;) // the chunks after IHDR
+        {
+            if (read(pos, head, 8) != 8)
+                return 30; // error: the file ends before the image data
+            unsigned long length = png.read32bitInt(head);
+            if (length > 2147483647)
+                return 63;
+            if (std::memcmp(&head[4], "IDAT", 4) == 0 ||
+                std::memcmp(&head[4], "IEND", 4) == 0)
+                break;
+            if (std::memcmp(&head[4], "PLTE", 4) == 0)
+            {
+                probe.paletteSize = length / 3;
+                if (probe.paletteSize > 256)
+                    return 38; // error: palette too big
+            }
+            else if (std::memcmp(&head[4], "tRNS", 4) == 0)
+                probe.transparency = true;
+            pos += 12 + length; // length, type, data and CRC
+        }
+        bool rgba32 = probe.colorType == 3 || probe.colorType == 6 ||
+                      (probe.transparency && probe.colorType != 4);
+        probe.channels = rgba32 ? 4 : probe.colorType == 0
+                                          ? 1
+                                          : probe.colorType == 4 ? 2 : 3;
+        return 0;
+    }
+}
+
+/*
+decodePNG: The picoPNG function, decodes a PNG file buffer in memory, into a raw
+pixel buffer.
+out_image: output parameter, this will contain the raw pixels after decoding.
+  By default the output is 32-bit RGBA color.
+  The std::vector is automatically resized to the correct size.
+image_width: output_parameter, this will contain the width of the image in
+pixels.
+image_height: output_parameter, this will contain the height of the image in
+pixels.
+in_png: pointer to the buffer of the PNG file in memory. To get it from a file
+on
+  disk, load it and store it in a memory buffer yourself first.
+in_size: size of the input PNG file in bytes.
+convert_to_rgba32: optional parameter, true by default.
+  Set to true to get the output in RGBA 32-bit (8 bit per channel) color format
+  no matter what color type the original PNG image had. This gives predictable,
+  useable data from any random input PNG.
+  Set to false to do no color conversion at all. The result then has the same
+data
+  type as the PNG image, which can range from 1 bit to 64 bits per pixel.
+  Information about the color type or palette colors are not provided. You need
+  to know this information yourself to be able to use the data so this only
+  works for trusted PNG files. Use LodePNG instead of picoPNG if you need this
+information.
+bottom_up: optional parameter, false by default.
+  Set to true to get the rows from the bottom of the image to the top, the order
+  glTexImage2D expects. The rows are written there while unfiltering, so this
+  costs nothing.
+verify_checksums: optional parameter, false by default.
+  Set to true to check the CRC of every chunk (error 57 if one is wrong) and the
+  Adler-32 of the image data (error 58), to catch corrupted files. Both are
+  computed while decoding, for a few percent of the decoding time.
+return: 0 if success, not 0 if some error occured.
+
+The overload with a decoder first keeps the scratch memory of decoding, the
+inflated scanlines, row buffers and Huffman tables, in decoder for the next
+call. Decoding image after image, like thousands of small icons, with the same
+decoder and out_image allocates nothing once the largest of them is decoded.
+A decoder is for one thread at a time, its releaseScratch() frees the memory.
+*/
+
+inline int decodePNG(picopng::PNG&               decoder,
+                     std::vector<unsigned char>& out_image,
+                     unsigned long&              image_width,
+                     unsigned long&              image_height,
+                     const unsigned char*        in_png,
+                     size_t                      in_size,
+                     bool                        convert_to_rgba32 = true,
+                     bool                        bottom_up         = false,
+                     bool                        verify_checksums  = false)
+{
+    decoder.decode(out_image, in_png, in_size, convert_to_rgba32, bottom_up,
+                   verify_checksums);
+    image_width  = decoder.info.width;
+    image_height = decoder.info.height;
+    return decoder.error;
+}
+
+inline int decodePNG(std::vector<unsigned char>& out_image,
+                     unsigned long&              image_width,
+                     unsigned long&              image_height,
+                     const unsigned char*        in_png,
+                     size_t                      in_size,
+                     bool                        convert_to_rgba32 = true,
+                     bool                        bottom_up         = false,
+                     bool                        verify_checksums  = false)
+{
+    picopng::PNG decoder;
+    return decodePNG(decoder, out_image, image_width, image_height, in_png,
+                     in_size, convert_to_rgba32, bottom_up, verify_checksums);
+}
+
+/*
+getPNGSizes and decodePNGInto: decodePNG in two steps, for callers that want
+the pixels in memory of their own, like a staging buffer or a mapped pixel
+buffer object, and no allocations or copies on the way.
+getPNGSizes reads only the IHDR chunk and gives:
+image_width, image_height: the size of the image in pixels.
+inflated_size: the size in bytes of the scanline buffer decodePNGInto needs to
+  inflate the image data into. The image is unfiltered in place there. It
+  includes a few bytes of slack past the image data, which let the inflater
+  copy repeated data in wide blocks up to the very end; a buffer without them
+  works too, only a little slower.
+image_size: the size in bytes of the decoded image, as decodePNG would give it
+  with the same convert_to_rgba32.
+decodePNGInto then decodes the PNG with buffers of at least those sizes:
+out_image, out_size: where the decoded image goes.
+inflated, inflated_size: the scanline buffer. Its contents are undefined after.
+The other parameters are those of decodePNG. Both return 0 if success, 90 if
+a buffer is too small, 93 if a side of the image is 0 or over 2^31 - 1 pixels,
+92 if its sizes don't fit in a size_t, and the decodePNG error codes
+otherwise.
+*/
+
+inline int getPNGSizes(const unsigned char* in_png,
+                       size_t               in_size,
+                       unsigned long&       image_width,
+                       unsigned long&       image_height,
+                       size_t&              inflated_size,
+                       size_t&              image_size,
+                       bool                 convert_to_rgba32 = true)
+{
+    picopng::PNG decoder;
+    if (in_size == 0 || in_png == 0)
+        return 48; // the given data is empty
+    decoder.error = 0;
+    decoder.readPngHeader(in_png, in_size);
+    if (decoder.error)
+        return decoder.error;
     image_width  = decoder.info.width;
     image_height = decoder.info.height;
+    decoder.getSizes(inflated_size, image_size, convert_to_rgba32);
+    inflated_size += picopng::Zlib::Inflator::SLACK;
+    return 0;
+}
+
+inline int decodePNGInto(unsigned char*       out_image,
+                         size_t               out_size,
+                         unsigned char*       inflated,
+                         size_t               inflated_size,
+                         const unsigned char* in_png,
+                         size_t               in_size,
+                         bool                 convert_to_rgba32 = true,
+                         bool                 bottom_up         = false,
+                         bool                 verify_checksums  = false)
+{
+    picopng::PNG decoder;
+    decoder.decodeInto(out_image, out_size, inflated, inflated_size, in_png,
+                       in_size, convert_to_rgba32, bottom_up, verify_checksums);
     return decoder.error;
 }
 
+/*
+decodePNGChannels: decodePNG for textures that keep the channels the PNG has,
+with 8 bits per sample, instead of RGBA 32-bit: a greyscale image is 1 byte
+per pixel, greyscale with alpha 2 and RGB 3. 16-bit samples are cut to their
+most significant byte, greyscale of under 8 bits is scaled up to 0..255.
+Palette images, RGBA and images with a transparent color key are converted to
+RGBA 32-bit as decodePNG does, they need all four channels.
+channels: output parameter, the number of bytes per pixel in out_image.
+The other parameters, the return value and the overload with a decoder are
+those of decodePNG.
+*/
+
+inline int decodePNGChannels(picopng::PNG&               decoder,
+                             std::vector<unsigned char>& out_image,
+                             unsigned long&              image_width,
+                             unsigned long&              image_height,
+                             unsigned int&               channels,
+                             const unsigned char*        in_png,
+                             size_t                      in_size,
+                             bool                        bottom_up = false,
+                             bool verify_checksums = false)
+{
+    if (in_size == 0 || in_png == 0)
+        return 48; // the given data is empty
+    decoder.error  = 0;
+    decoder.verify = verify_checksums;
+    decoder.readPngHeader(in_png, in_size);
+    if (decoder.error)
+        return decoder.error;
+    const picopng::PNG::Info& info = decoder.info;
+    bool rgba32 = info.colorType == 3 || info.colorType == 6;
+    decoder.decode(out_image, in_png, in_size, rgba32, bottom_up,
+                   verify_checksums);
+    image_width  = info.width;
+    image_height = info.height;
+    channels     = 4;
+    if (decoder.error || rgba32)
+        return decoder.error;
+    size_t numpixels = info.width * info.height;
+    if (info.key_defined) // the key is only known after decoding
+    {   // the inflated scanlines had room for the pixels, and are done with
+        decoder.inflated.assign(out_image.begin(), out_image.end());
+        out_image.resize(numpixels * 4);
+        decoder.error = decoder.convert(&out_image[0], &decoder.inflated[0],
+                                        info, info.width, info.height);
+        return decoder.error;
+    }
+    channels = info.colorType == 0 ? 1 : info.colorType == 4 ? 2 : 3;
+    if (info.bitDepth == 16) // in place, keeping the high bytes
+    {
+        for (size_t i = 0; i < numpixels * channels; i++)
+            out_image[i] = out_image[2 * i];
+        out_image.resize(numpixels * channels);
+    }
+    else if (info.bitDepth < 8) // the rows are packed without padding
+    {   // in place from the last pixel, whose bits come at or before it
+        out_image.resize(numpixels);
+        unsigned long scale = 255 / ((1 << info.bitDepth) - 1);
+        for (size_t i = numpixels; i-- > 0;)
+        {
+            size_t        bp     = i * info.bitDepth;
+            unsigned long sample = picopng::PNG::readBitsFromReversedStream(
+                bp, &out_image[0], info.bitDepth);
+            out_image[i] = (unsigned char)(scale * sample);
+        }
+    }
+    return 0;
+}
+
+inline int decodePNGChannels(std::vector<unsigned char>& out_image,
+                             unsigned long&              image_width,
+                             unsigned long&              image_height,
+                             unsigned int&               channels,
+                             const unsigned char*        in_png,
+                             size_t                      in_size,
+                             bool                        bottom_up = false,
+                             bool verify_checksums = false)
+{
+    picopng::PNG decoder;
+    return decodePNGChannels(decoder, out_image, image_width, image_height,
+                             channels, in_png, in_size, bottom_up,
+                             verify_checksums);
+}
+
+/*
+probePNG: tells the size and format of a PNG without decoding it, for
+planning atlases and texture memory ahead of loading. Only the IHDR chunk and
+the 8 byte heads of the chunks before the image data are read, so probing
+costs the same for a 16x16 icon and an 8192x8192 texture.
+in_png, in_size: the PNG in memory, or mapped with mmap: of the mapping only
+  the pages with those chunk heads are touched.
+fd: or a file open for reading, read from its start with pread, a system
+  call for each chunk before the image data, of which most files have a few.
+  The offset of fd is left where it was, except on Windows, which has no pread.
+probe: output parameter, the width, height, color type, bit depth and
+  interlace method of the IHDR chunk, the number of PLTE colors (0 without a
+  palette), whether there is a tRNS chunk, and the channels decodePNGChannels
+  would decode the image to. Nothing past the image data is read, so these
+  are known before decoding but the chunks are not checked beyond their heads:
+  a file probePNG accepts can still fail to decode.
+return: 0 if success, the decodePNG error code of the header or chunk heads
+  otherwise, 30 if the file ends before the image data.
+*/
+
+inline int probePNG(const unsigned char* in_png,
+                    size_t               in_size,
+                    picopng::Probe&      probe)
+{
+    if (in_size == 0 || in_png == 0)
+        return 48; // the given data is empty
+    return picopng::probeChunks(
+        [=](unsigned long long pos, unsigned char* buffer, size_t size) {
+            if (pos >= in_size)
+                return size_t(0);
+            size = std::min<size_t>(size, in_size - pos);
+            std::memcpy(buffer, in_png + pos, size);
+            return size;
+        },
+        probe);
+}
+
+inline int probePNG(int fd, picopng::Probe& probe)
+{
+    return picopng::probeChunks(
+        [=](unsigned long long pos, unsigned char* buffer, size_t size) {
+            size_t done = 0;
+            while (done < size)
+            {
+#ifdef _WIN32
+                long long n =
+                    _lseeki64(fd, (long long)(pos + done), SEEK_SET) < 0
+                        ? -1
+                        : _read(fd, buffer + done, (unsigned)(size - done));
+#else
+                long long n = pread(fd, buffer + done, size - done,
+                                    (off_t)(pos + done));
+#endif
+                if (n <= 0)
+                    break;
+                done += (size_t)n;
+            }
+            return done;
+        },
+        probe);
+}
+
 // an example using the PNG loading function:
 
 #include <fstream>
@@ -0,0 +1,750 @@
+#pragma once
+
+#include "SDL_cpuinfo.h"
+#include <cstddef>
+#include <cstring>
+
+/*
+SIMD kernels used by picopng.hxx, selected once at runtime with the CPU
+detection of SDL. Every kernel produces exactly the same bytes as the scalar
+code in picopng.hxx, which stays the reference implementation and the fallback
+on CPUs (or compilers) without the needed instruction sets.
+
+Only the x86 family is covered: SSE2, SSSE3 and AVX2 kernels are compiled with
+per-function target attributes, so the rest of the engine keeps its baseline
+instruction set.
+
+The tables of selected kernels can be written, before any decoding starts:
+test/test_simd.cpp empties them to run the scalar code it checks each kernel
+against.
+*/
+
+#if (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||           \
+     defined(_M_IX86)) &&                                                      \
+    !defined(PICOPNG_NO_SIMD)
+#define PICOPNG_X86_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define PICOPNG_TARGET(isa)
+#else
+#include <cpuid.h>
+#define PICOPNG_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace picopng
+{
+    // recon, scanline and precon as in PNG::unFilterScanline; precon is
+    // only null for sub, the first scanline of an image stays scalar
+    // otherwise. recon may be scanline itself, for unfiltering in place
+    typedef void (*UnfilterKernel)(unsigned char*       recon,
+                                   const unsigned char* scanline,
+                                   const unsigned char* precon,
+                                   size_t bytewidth, size_t length);
+
+    struct UnfilterKernels
+    {
+        UnfilterKernel up    = nullptr; // any bytewidth
+        UnfilterKernel sub   = nullptr; // bytewidth 3 and 4 only
+        UnfilterKernel avg   = nullptr; // bytewidth 3 and 4 only
+        UnfilterKernel paeth = nullptr; // bytewidth 3 and 4 only
+    };
+
+    // out gets numpixels 32-bit RGBA pixels converted from the 8-bit ones at
+    // in, as PNG::convert does it. key is the tRNS color, the grey value or
+    // red | green << 8 | blue << 16, and palette holds the RGBA entries of
+    // PNG::Info::palette. A palette kernel returns false without finishing
+    // when an index is out of range, leaving the error to the scalar code
+    typedef void (*ConvertKernel)(unsigned char*       out,
+                                  const unsigned char* in,
+                                  size_t               numpixels);
+    typedef void (*KeyConvertKernel)(unsigned char*       out,
+                                     const unsigned char* in,
+                                     size_t numpixels, unsigned int key);
+    typedef bool (*PaletteKernel)(unsigned char*       out,
+                                  const unsigned char* in, size_t numpixels,
+                                  const unsigned char* palette,
+                                  size_t               palettesize);
+
+    struct ConvertKernels
+    {
+        ConvertKernel    grey      = nullptr; // color type 0
+        KeyConvertKernel greyKey   = nullptr; // color type 0 with tRNS
+        ConvertKernel    rgb       = nullptr; // color type 2
+        KeyConvertKernel rgbKey    = nullptr; // color type 2 with tRNS
+        PaletteKernel    palette   = nullptr; // color type 3
+        ConvertKernel    greyAlpha = nullptr; // color type 4
+    };
+
+    // checksum is the CRC-32 or Adler-32 of the data before, returns it
+    // with the size bytes at data added, as PNG::crc32 and Zlib::adler32 do.
+    // A CRC-32 kernel takes a size of at least 64 and a multiple of 16
+    typedef unsigned long (*ChecksumKernel)(unsigned long        checksum,
+                                            const unsigned char* data,
+                                            size_t               size);
+
+    struct ChecksumKernels
+    {
+        ChecksumKernel crc32   = nullptr;
+        ChecksumKernel adler32 = nullptr;
+    };
+
+#ifdef PICOPNG_X86_SIMD
+    namespace simd
+    {
+        // one pixel of 3 or 4 bytes in the low lanes of a register; the
+        // width is a template argument so the copies compile to plain moves,
+        // and 3 byte pixels are assembled in a register rather than through
+        // memory to avoid store forwarding stalls
+        template <size_t bytewidth>
+        PICOPNG_TARGET("sse2")
+        inline __m128i loadPixel(const unsigned char* p)
+        {
+            int value = 0;
+            if (bytewidth == 4)
+                std::memcpy(&value, p, 4);
+            else
+                value = p[0] | (p[1] << 8) | (p[2] << 16);
+            return _mm_cvtsi32_si128(value);
+        }
+
+        template <size_t bytewidth>
+        PICOPNG_TARGET("sse2")
+        inline void storePixel(unsigned char* p, __m128i v)
+        {
+            int value = _mm_cvtsi128_si32(v);
+            if (bytewidth == 4)
+                std::memcpy(p, &value, 4);
+            else
+            {
+                p[0] = (unsigned char)value;
+                p[1] = (unsigned char)(value >> 8);
+                p[2] = (unsigned char)(value >> 16);
+            }
+        }
+
+        PICOPNG_TARGET("sse2")
+        inline void upSSE2(unsigned char*       recon,
+                           const unsigned char* scanline,
+                           const unsigned char* precon,
+                           size_t /*bytewidth*/,
+                           size_t length)
+        {
+            size_t i = 0;
+            for (; i + 16 <= length; i += 16)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+                __m128i b = _mm_loadu_si128((const __m128i*)(precon + i));
+                _mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(x, b));
+            }
+            for (; i < length; i++)
+                recon[i] = scanline[i] + precon[i];
+        }
+
+        PICOPNG_TARGET("avx2")
+        inline void upAVX2(unsigned char*       recon,
+                           const unsigned char* scanline,
+                           const unsigned char* precon,
+                           size_t /*bytewidth*/,
+                           size_t length)
+        {
+            size_t i = 0;
+            for (; i + 32 <= length; i += 32)
+            {
+                __m256i x = _mm256_loadu_si256((const __m256i*)(scanline + i));
+                __m256i b = _mm256_loadu_si256((const __m256i*)(precon + i));
+                _mm256_storeu_si256((__m256i*)(recon + i),
+                                    _mm256_add_epi8(x, b));
+            }
+            for (; i < length; i++)
+                recon[i] = scanline[i] + precon[i];
+        }
+
+        // Sub is a running sum over the pixels, computed for 4 pixels at a
+        // time as a prefix sum inside the register plus the last pixel of
+        // the previous group.
+        PICOPNG_TARGET("sse2")
+        inline void subSSE2(unsigned char*       recon,
+                            const unsigned char* scanline,
+                            const unsigned char* /*precon*/,
+                            size_t bytewidth,
+                            size_t length)
+        {
+            __m128i last = _mm_setzero_si128();
+            size_t  i    = 0;
+            if (bytewidth == 4)
+            {
+                for (; i + 16 <= length; i += 16)
+                {
+                    __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+                    x         = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+                    x         = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+                    x         = _mm_add_epi8(x, last);
+                    _mm_storeu_si128((__m128i*)(recon + i), x);
+                    last = _mm_shuffle_epi32(x, 0xFF);
+                }
+                for (; i < length; i += 4)
+                {
+                    last = _mm_add_epi8(last, loadPixel<4>(scanline + i));
+                    storePixel<4>(recon + i, last);
+                }
+            }
+            else
+            {
+                const __m128i mask = _mm_cvtsi32_si128(0xFFFFFF);
+                for (; i + 16 <= length; i += 12)
+                {
+                    __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+                    x         = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+                    x         = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+                    x         = _mm_add_epi8(x, last);
+                    _mm_storel_epi64((__m128i*)(recon + i), x);
+                    storePixel<4>(recon + i + 8, _mm_srli_si128(x, 8));
+                    last = _mm_and_si128(_mm_srli_si128(x, 9), mask);
+                    last = _mm_or_si128(last, _mm_slli_si128(last, 3));
+                    last = _mm_or_si128(last, _mm_slli_si128(last, 6));
+                }
+                for (; i < length; i += 3)
+                {
+                    last = _mm_add_epi8(last, loadPixel<3>(scanline + i));
+                    storePixel<3>(recon + i, last);
+                }
+            }
+        }
+
+        template <size_t bytewidth>
+        PICOPNG_TARGET("sse2")
+        inline void avgPixels(unsigned char*       recon,
+                              const unsigned char* scanline,
+                              const unsigned char* precon,
+                              size_t               length)
+        {
+            const __m128i one = _mm_set1_epi8(1);
+            __m128i       a   = _mm_setzero_si128(); // recon[i - bytewidth]
+            for (size_t i = 0; i < length; i += bytewidth)
+            {
+                __m128i b = loadPixel<bytewidth>(precon + i);
+                // _mm_avg_epu8 rounds up, PNG rounds down
+                __m128i avg =
+                    _mm_sub_epi8(_mm_avg_epu8(a, b),
+                                 _mm_and_si128(_mm_xor_si128(a, b), one));
+                a = _mm_add_epi8(loadPixel<bytewidth>(scanline + i), avg);
+                storePixel<bytewidth>(recon + i, a);
+            }
+        }
+
+        PICOPNG_TARGET("sse2")
+        inline void avgSSE2(unsigned char*       recon,
+                            const unsigned char* scanline,
+                            const unsigned char* precon,
+                            size_t               bytewidth,
+                            size_t               length)
+        {
+            if (bytewidth == 4)
+                avgPixels<4>(recon, scanline, precon, length);
+            else
+                avgPixels<3>(recon, scanline, precon, length);
+        }
+
+        // picks a, b or c per channel with the tie rules of paethPredictor,
+        // pa, pb and pc being the absolute distances as 16-bit lanes
+        PICOPNG_TARGET("sse2")
+        inline __m128i paethSelect(__m128i a,
+                                   __m128i b,
+                                   __m128i c,
+                                   __m128i pa,
+                                   __m128i pb,
+                                   __m128i pc)
+        {
+            __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+            // c unless pb is the smallest, then b unless pa is, then a
+            __m128i mask = _mm_cmpeq_epi16(smallest, pb);
+            __m128i pick =
+                _mm_xor_si128(c, _mm_and_si128(mask, _mm_xor_si128(b, c)));
+            mask = _mm_cmpeq_epi16(smallest, pa);
+            return _mm_xor_si128(pick,
+                                 _mm_and_si128(mask, _mm_xor_si128(a, pick)));
+        }
+
+        template <size_t bytewidth>
+        PICOPNG_TARGET("sse2")
+        inline void paethPixelsSSE2(unsigned char*       recon,
+                                    const unsigned char* scanline,
+                                    const unsigned char* precon,
+                                    size_t               length)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            __m128i       a = zero, c = zero; // left and upper left pixels
+            for (size_t i = 0; i < length; i += bytewidth)
+            {
+                __m128i b =
+                    _mm_unpacklo_epi8(loadPixel<bytewidth>(precon + i), zero);
+                __m128i pa = _mm_sub_epi16(b, c); // p - a
+                __m128i pb = _mm_sub_epi16(a, c); // p - b
+                __m128i pc = _mm_add_epi16(pa, pb);
+                pa         = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+                pb         = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+                pc         = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+                __m128i predicted = paethSelect(a, b, c, pa, pb, pc);
+                __m128i x =
+                    _mm_add_epi8(loadPixel<bytewidth>(scanline + i),
+                                 _mm_packus_epi16(predicted, predicted));
+                storePixel<bytewidth>(recon + i, x);
+                c = b;
+                a = _mm_unpacklo_epi8(x, zero);
+            }
+        }
+
+        PICOPNG_TARGET("sse2")
+        inline void paethSSE2(unsigned char*       recon,
+                              const unsigned char* scanline,
+                              const unsigned char* precon,
+                              size_t               bytewidth,
+                              size_t               length)
+        {
+            if (bytewidth == 4)
+                paethPixelsSSE2<4>(recon, scanline, precon, length);
+            else
+                paethPixelsSSE2<3>(recon, scanline, precon, length);
+        }
+
+        template <size_t bytewidth>
+        PICOPNG_TARGET("ssse3")
+        inline void paethPixelsSSSE3(unsigned char*       recon,
+                                     const unsigned char* scanline,
+                                     const unsigned char* precon,
+                                     size_t               length)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            __m128i       a = zero, c = zero; // left and upper left pixels
+            for (size_t i = 0; i < length; i += bytewidth)
+            {
+                __m128i b =
+                    _mm_unpacklo_epi8(loadPixel<bytewidth>(precon + i), zero);
+                __m128i pa = _mm_sub_epi16(b, c); // p - a
+                __m128i pb = _mm_sub_epi16(a, c); // p - b
+                __m128i pc = _mm_abs_epi16(_mm_add_epi16(pa, pb));
+                pa         = _mm_abs_epi16(pa);
+                pb         = _mm_abs_epi16(pb);
+                __m128i predicted = paethSelect(a, b, c, pa, pb, pc);
+                __m128i x =
+                    _mm_add_epi8(loadPixel<bytewidth>(scanline + i),
+                                 _mm_packus_epi16(predicted, predicted));
+                storePixel<bytewidth>(recon + i, x);
+                c = b;
+                a = _mm_unpacklo_epi8(x, zero);
+            }
+        }
+
+        PICOPNG_TARGET("ssse3")
+        inline void paethSSSE3(unsigned char*       recon,
+                               const unsigned char* scanline,
+                               const unsigned char* precon,
+                               size_t               bytewidth,
+                               size_t               length)
+        {
+            if (bytewidth == 4)
+                paethPixelsSSSE3<4>(recon, scanline, precon, length);
+            else
+                paethPixelsSSSE3<3>(recon, scanline, precon, length);
+        }
+
+        // Grey is spread over the color channels with two unpacks, which
+        // also put it in alpha; that byte is then replaced, by 255 or, with
+        // a color key, by 0 where the grey value equals the key.
+        template <bool keyed>
+        PICOPNG_TARGET("sse2")
+        inline void greyPixelsSSE2(unsigned char*       out,
+                                   const unsigned char* in,
+                                   size_t               numpixels,
+                                   unsigned int         key)
+        {
+            const __m128i rgb   = _mm_set1_epi32(0x00FFFFFF);
+            const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+            const __m128i keys  = _mm_set1_epi8((char)key);
+            size_t        i     = 0;
+            for (; i + 16 <= numpixels; i += 16)
+            {
+                __m128i g  = _mm_loadu_si128((const __m128i*)(in + i));
+                __m128i gg[2] = { _mm_unpacklo_epi8(g, g),
+                                  _mm_unpackhi_epi8(g, g) };
+                __m128i m  = keyed ? _mm_cmpeq_epi8(g, keys) : g;
+                __m128i mm[2] = { _mm_unpacklo_epi8(m, m),
+                                  _mm_unpackhi_epi8(m, m) };
+                for (int h = 0; h < 4; h++)
+                {
+                    __m128i x = (h & 1) ? _mm_unpackhi_epi16(gg[h >> 1],
+                                                             gg[h >> 1])
+                                        : _mm_unpacklo_epi16(gg[h >> 1],
+                                                             gg[h >> 1]);
+                    if (keyed) // the mask, spread like the grey values
+                    {
+                        __m128i k = (h & 1) ? _mm_unpackhi_epi16(mm[h >> 1],
+                                                                 mm[h >> 1])
+                                            : _mm_unpacklo_epi16(mm[h >> 1],
+                                                                 mm[h >> 1]);
+                        x = _mm_or_si128(_mm_and_si128(x, rgb),
+                                         _mm_andnot_si128(k, alpha));
+                    }
+                    else
+                        x = _mm_or_si128(x, alpha);
+                    _mm_storeu_si128((__m128i*)(out + 4 * i + 16 * h), x);
+                }
+            }
+            for (; i < numpixels; i++)
+            {
+                out[4 * i + 0] = out[4 * i + 1] = out[4 * i + 2] = in[i];
+                out[4 * i + 3] = (keyed && in[i] == key) ? 0 : 255;
+            }
+        }
+
+        PICOPNG_TARGET("sse2")
+        inline void greySSE2(unsigned char*       out,
+                             const unsigned char* in,
+                             size_t               numpixels)
+        {
+            greyPixelsSSE2<false>(out, in, numpixels, 0);
+        }
+
+        PICOPNG_TARGET("sse2")
+        inline void greyKeySSE2(unsigned char*       out,
+                                const unsigned char* in,
+                                size_t               numpixels,
+                                unsigned int         key)
+        {
+            greyPixelsSSE2<true>(out, in, numpixels, key);
+        }
+
+        // RGB to RGBA moves the bytes of 4 pixels into place with one
+        // shuffle, leaving alpha zero; a color key is a match of all three
+        // channels, so of the whole 32-bit lane before alpha is set.
+        template <bool keyed>
+        PICOPNG_TARGET("ssse3")
+        inline void rgbPixelsSSSE3(unsigned char*       out,
+                                   const unsigned char* in,
+                                   size_t               numpixels,
+                                   unsigned int         key)
+        {
+            const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6,
+                                                 7, 8, -1, 9, 10, 11, -1);
+            const __m128i alpha  = _mm_set1_epi32((int)0xFF000000);
+            const __m128i keys   = _mm_set1_epi32((int)key);
+            size_t        i      = 0;
+            for (; i + 6 <= numpixels; i += 4) // reads 16 of 18 bytes
+            {
+                __m128i x = _mm_loadu_si128((const __m128i*)(in + 3 * i));
+                x         = _mm_shuffle_epi8(x, spread);
+                if (keyed)
+                    x = _mm_or_si128(
+                        x, _mm_andnot_si128(_mm_cmpeq_epi32(x, keys), alpha));
+                else
+                    x = _mm_or_si128(x, alpha);
+                _mm_storeu_si128((__m128i*)(out + 4 * i), x);
+            }
+            for (; i < numpixels; i++)
+            {
+                for (size_t c       = 0; c < 3; c++)
+                    out[4 * i + c] = in[3 * i + c];
+                out[4 * i + 3] =
+                    (keyed && in[3 * i + 0] == (key & 255) &&
+                     in[3 * i + 1] == ((key >> 8) & 255) &&
+                     in[3 * i + 2] == (key >> 16))
+                        ? 0
+                        : 255;
+            }
+        }
+
+        PICOPNG_TARGET("ssse3")
+        inline void rgbSSSE3(unsigned char*       out,
+                             const unsigned char* in,
+                             size_t               numpixels)
+        {
+            rgbPixelsSSSE3<false>(out, in, numpixels, 0);
+        }
+
+        PICOPNG_TARGET("ssse3")
+        inline void rgbKeySSSE3(unsigned char*       out,
+                                const unsigned char* in,
+                                size_t               numpixels,
+                                unsigned int         key)
+        {
+            rgbPixelsSSSE3<true>(out, in, numpixels, key);
+        }
+
+        PICOPNG_TARGET("ssse3")
+        inline void greyAlphaSSSE3(unsigned char*       out,
+                                   const unsigned char* in,
+                                   size_t               numpixels)
+        {
+            const __m128i lo = _mm_setr_epi8(0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4,
+                                             5, 6, 6, 6, 7);
+            const __m128i hi = _mm_setr_epi8(8, 8, 8, 9, 10, 10, 10, 11, 12,
+                                             12, 12, 13, 14, 14, 14, 15);
+            size_t i = 0;
+            for (; i + 8 <= numpixels; i += 8)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i*)(in + 2 * i));
+                _mm_storeu_si128((__m128i*)(out + 4 * i),
+                                 _mm_shuffle_epi8(x, lo));
+                _mm_storeu_si128((__m128i*)(out + 4 * i + 16),
+                                 _mm_shuffle_epi8(x, hi));
+            }
+            for (; i < numpixels; i++)
+            {
+                out[4 * i + 0] = out[4 * i + 1] = out[4 * i + 2] = in[2 * i];
+                out[4 * i + 3] = in[2 * i + 1];
+            }
+        }
+
+        // the largest palette index of a row, to check them all at once
+        PICOPNG_TARGET("sse2")
+        inline unsigned char maxIndexSSE2(const unsigned char* in,
+                                          size_t               numpixels)
+        {
+            __m128i m = _mm_setzero_si128();
+            size_t  i = 0;
+            for (; i + 16 <= numpixels; i += 16)
+                m = _mm_max_epu8(m, _mm_loadu_si128((const __m128i*)(in + i)));
+            m = _mm_max_epu8(m, _mm_srli_si128(m, 8));
+            m = _mm_max_epu8(m, _mm_srli_si128(m, 4));
+            m = _mm_max_epu8(m, _mm_srli_si128(m, 2));
+            m = _mm_max_epu8(m, _mm_srli_si128(m, 1));
+            unsigned char result = (unsigned char)_mm_cvtsi128_si32(m);
+            for (; i < numpixels; i++)
+                if (in[i] > result)
+                    result = in[i];
+            return result;
+        }
+
+        // Palette entries are already RGBA, so each pixel is one 32-bit
+        // load, done 8 at a time by the AVX2 gather.
+        PICOPNG_TARGET("avx2")
+        inline bool paletteAVX2(unsigned char*       out,
+                                const unsigned char* in,
+                                size_t               numpixels,
+                                const unsigned char* palette,
+                                size_t               palettesize)
+        {
+            if (numpixels == 0)
+                return true;
+            if (4U * maxIndexSSE2(in, numpixels) >= palettesize)
+                return false;
+            size_t i = 0;
+            for (; i + 8 <= numpixels; i += 8)
+            {
+                __m256i index = _mm256_cvtepu8_epi32(
+                    _mm_loadl_epi64((const __m128i*)(in + i)));
+                _mm256_storeu_si256(
+                    (__m256i*)(out + 4 * i),
+                    _mm256_i32gather_epi32((const int*)palette, index, 4));
+            }
+            for (; i < numpixels; i++)
+                std::memcpy(out + 4 * i, palette + 4 * in[i], 4);
+            return true;
+        }
+
+        // SDL has no PCLMULQDQ query, so CPUID leaf 1 is read directly: ECX
+        // bit 1 is PCLMULQDQ and bit 19 SSE4.1. Hypervisors can mask
+        // PCLMULQDQ while exposing AVX, so neither is inferred from the other
+        inline bool hasPCLMUL()
+        {
+            unsigned int ecx = 0;
+#if defined(_MSC_VER) && !defined(__clang__)
+            int info[4];
+            __cpuid(info, 1);
+            ecx = (unsigned int)info[2];
+#else
+            unsigned int eax, ebx, edx;
+            if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+                return false;
+#endif
+            return (ecx & (1u << 1)) && (ecx & (1u << 19));
+        }
+
+        // CRC-32 by folding: four 128-bit lanes are carried along the data,
+        // 64 bytes a step, with carry-less multiplies by x^n mod P for the
+        // distance they move. They are folded into one, reduced to 64 bits
+        // and then to the 32-bit CRC with a Barrett reduction. The constants
+        // are those of the bit-reflected CRC-32 from Intel's "Fast CRC
+        // Computation for Generic Polynomials Using PCLMULQDQ Instruction"
+        PICOPNG_TARGET("pclmul,sse4.1")
+        inline __m128i foldCrc(__m128i x, __m128i k, __m128i next)
+        {
+            __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+            __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+            return _mm_xor_si128(_mm_xor_si128(lo, hi), next);
+        }
+
+        PICOPNG_TARGET("pclmul,sse4.1")
+        inline unsigned long crc32PCLMUL(unsigned long        crc,
+                                         const unsigned char* data,
+                                         size_t               size)
+        {
+            const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+            const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+            const __m128i k5   = _mm_set_epi64x(0, 0x0163cd6124);
+            const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+            const __m128i low32 = _mm_setr_epi32(-1, 0, -1, 0);
+            __m128i x1 = _mm_loadu_si128((const __m128i*)data);
+            __m128i x2 = _mm_loadu_si128((const __m128i*)(data + 16));
+            __m128i x3 = _mm_loadu_si128((const __m128i*)(data + 32));
+            __m128i x4 = _mm_loadu_si128((const __m128i*)(data + 48));
+            x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)~crc));
+            for (data += 64, size -= 64; size >= 64; data += 64, size -= 64)
+            {
+                x1 = foldCrc(x1, k1k2, _mm_loadu_si128((const __m128i*)data));
+                x2 = foldCrc(x2, k1k2,
+                             _mm_loadu_si128((const __m128i*)(data + 16)));
+                x3 = foldCrc(x3, k1k2,
+                             _mm_loadu_si128((const __m128i*)(data + 32)));
+                x4 = foldCrc(x4, k1k2,
+                             _mm_loadu_si128((const __m128i*)(data + 48)));
+            }
+            x1 = foldCrc(foldCrc(foldCrc(x1, k3k4, x2), k3k4, x3), k3k4, x4);
+            for (; size >= 16; data += 16, size -= 16)
+                x1 = foldCrc(x1, k3k4, _mm_loadu_si128((const __m128i*)data));
+            // 128 bits to 64, then Barrett reduction to 32
+            x1 = _mm_xor_si128(_mm_srli_si128(x1, 8),
+                               _mm_clmulepi64_si128(x1, k3k4, 0x10));
+            x1 = _mm_xor_si128(_mm_srli_si128(x1, 4),
+                               _mm_clmulepi64_si128(_mm_and_si128(x1, low32),
+                                                    k5, 0x00));
+            x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+            x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, low32), poly, 0x00);
+            x1 = _mm_xor_si128(x1, x2);
+            return ~(unsigned long)(unsigned int)_mm_extract_epi32(x1, 1) &
+                   0xFFFFFFFFUL;
+        }
+
+        // Adler-32 a block of 32 bytes at a time: the sums of the bytes go to
+        // s1 with psadbw, and each byte weighted by its distance to the end
+        // of the block to s2 with pmaddubsw. s2 also needs 32 times s1 for
+        // every block, which is summed up in ps. Up to 5552 bytes fit before
+        // the sums have to be reduced modulo 65521
+        PICOPNG_TARGET("ssse3")
+        inline unsigned long adler32SSSE3(unsigned long        adler,
+                                          const unsigned char* data,
+                                          size_t               size)
+        {
+            const __m128i weights1 =
+                _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21,
+                              20, 19, 18, 17);
+            const __m128i weights2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10,
+                                                   9, 8, 7, 6, 5, 4, 3, 2, 1);
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i ones = _mm_set1_epi16(1);
+            unsigned long s1 = adler & 0xffff, s2 = (adler >> 16) & 0xffff;
+            size_t        blocks = size / 32;
+            while (blocks)
+            {
+                size_t n = blocks < 5552 / 32 ? blocks : 5552 / 32;
+                blocks -= n;
+                __m128i vps = _mm_cvtsi32_si128((int)(s1 * n));
+                __m128i vs1 = zero;
+                __m128i vs2 = _mm_cvtsi32_si128((int)s2);
+                for (; n; n--, data += 32)
+                {
+                    __m128i a = _mm_loadu_si128((const __m128i*)data);
+                    __m128i b = _mm_loadu_si128((const __m128i*)(data + 16));
+                    vps       = _mm_add_epi32(vps, vs1);
+                    vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(a, zero));
+                    vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(b, zero));
+                    vs2 = _mm_add_epi32(
+                        vs2, _mm_madd_epi16(_mm_maddubs_epi16(a, weights1),
+                                            ones));
+                    vs2 = _mm_add_epi32(
+                        vs2, _mm_madd_epi16(_mm_maddubs_epi16(b, weights2),
+                                            ones));
+                }
+                vs2 = _mm_add_epi32(vs2, _mm_slli_epi32(vps, 5));
+                vs1 = _mm_add_epi32(vs1, _mm_shuffle_epi32(vs1, 0x4E));
+                vs2 = _mm_add_epi32(vs2, _mm_shuffle_epi32(vs2, 0xB1));
+                vs2 = _mm_add_epi32(vs2, _mm_shuffle_epi32(vs2, 0x4E));
+                s1 = (s1 + (unsigned int)_mm_cvtsi128_si32(vs1)) % 65521;
+                s2 = (unsigned int)_mm_cvtsi128_si32(vs2) % 65521;
+            }
+            size %= 32;
+            for (size_t i = 0; i < size; i++)
+            {
+                s1 += data[i];
+                s2 += s1;
+            }
+            return (s2 % 65521) << 16 | (s1 % 65521);
+        }
+    }
+#endif
+
+    inline UnfilterKernels selectUnfilterKernels()
+    {
+        UnfilterKernels kernels;
+#ifdef PICOPNG_X86_SIMD
+        if (SDL_HasSSE2())
+        {
+            kernels.up    = simd::upSSE2;
+            kernels.sub   = simd::subSSE2;
+            kernels.avg   = simd::avgSSE2;
+            kernels.paeth = simd::paethSSE2;
+        }
+        // SDL has no SSSE3 query, every CPU with SSE4.1 also has SSSE3
+        if (SDL_HasSSE41())
+            kernels.paeth = simd::paethSSSE3;
+        if (SDL_HasAVX2())
+            kernels.up = simd::upAVX2;
+#endif
+        return kernels;
+    }
+
+    inline UnfilterKernels& unfilterKernels()
+    {
+        static UnfilterKernels kernels = selectUnfilterKernels();
+        return kernels;
+    }
+
+    inline ConvertKernels selectConvertKernels()
+    {
+        ConvertKernels kernels;
+#ifdef PICOPNG_X86_SIMD
+        if (SDL_HasSSE2())
+        {
+            kernels.grey    = simd::greySSE2;
+            kernels.greyKey = simd::greyKeySSE2;
+        }
+        // SDL has no SSSE3 query, every CPU with SSE4.1 also has SSSE3
+        if (SDL_HasSSE41())
+        {
+            kernels.rgb       = simd::rgbSSSE3;
+            kernels.rgbKey    = simd::rgbKeySSSE3;
+            kernels.greyAlpha = simd::greyAlphaSSSE3;
+        }
+        if (SDL_HasAVX2())
+            kernels.palette = simd::paletteAVX2;
+#endif
+        return kernels;
+    }
+
+    inline ConvertKernels& convertKernels()
+    {
+        static ConvertKernels kernels = selectConvertKernels();
+        return kernels;
+    }
+
+    inline ChecksumKernels selectChecksumKernels()
+    {
+        ChecksumKernels kernels;
+#ifdef PICOPNG_X86_SIMD
+        // SDL has no SSSE3 query, every CPU with SSE4.1 also has SSSE3
+        if (SDL_HasSSE41())
+            kernels.adler32 = simd::adler32SSSE3;
+        if (simd::hasPCLMUL())
+            kernels.crc32 = simd::crc32PCLMUL;
+#endif
+        return kernels;
+    }
+
+    inline ChecksumKernels& checksumKernels()
+    {
+        static ChecksumKernels kernels = selectChecksumKernels();
+        return kernels;
+    }
+}
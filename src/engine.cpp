@@ -1,17 +1,41 @@
 #include "../include/engine.hpp"
+#include "../include/baked_texture.hpp"
 #include "../include/glew.h"
 #include "../include/SDL.h"
 #include "../include/SDL_opengl.h"
+#include "../include/block_compression.hpp"
 #include "../include/engine_constants.hpp"
+#include "../include/mipmap.hpp"
 #include "../include/picopng.hxx"
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <exception>
+#include <functional>
 #include <iostream>
 #include <fstream>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #define GE_GL_CHECK()                                                          \
     {                                                                          \
@@ -43,6 +67,15 @@
 
 namespace ge
 {
+    // s_channels of a streamed texture not uploaded yet, which the fragment
+    // shader draws transparent
+    const int placeholder_channels = -1;
+
+    // the ring streamed rows are staged in: a band of rows fits a buffer,
+    // and a few bands can be on their way to textures at once
+    const size_t pixel_buffer_bytes = 1024 * 1024;
+    const size_t pixel_buffer_count = 4;
+
     struct bind_event
     {
         bind_event(Uint32 _sdl_type, events_t _type, std::string _event_str)
@@ -66,11 +99,192 @@ namespace ge
         std::string key_str;
     };
 
+    class worker_pool
+    {
+    public:
+        explicit worker_pool(unsigned int threads_count)
+        {
+            for (unsigned int i = 0; i < threads_count; ++i)
+            {
+                workers.emplace_back(&worker_pool::run, this);
+            }
+        }
+
+        ~worker_pool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(jobs_mutex);
+                stopping = true;
+            }
+            jobs_cv.notify_all();
+            for (std::thread& worker : workers)
+            {
+                worker.join();
+            }
+        }
+
+        void add_job(std::function<void()> job)
+        {
+            {
+                std::lock_guard<std::mutex> lock(jobs_mutex);
+                jobs.push_back(std::move(job));
+            }
+            jobs_cv.notify_one();
+        }
+
+    private:
+        void run()
+        {
+            for (;;)
+            {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(jobs_mutex);
+                    jobs_cv.wait(lock,
+                                 [this] { return stopping || !jobs.empty(); });
+                    if (jobs.empty())
+                        return;
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+                job();
+            }
+        }
+
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> jobs;
+        std::mutex jobs_mutex;
+        std::condition_variable jobs_cv;
+        bool stopping = false;
+    };
+
+    // a file mapped read only, unmapped with the last reference to it
+    class mapped_file
+    {
+    public:
+        // null if the file can't be opened or is empty
+        static std::shared_ptr<mapped_file> map(const std::string& path);
+        ~mapped_file();
+        const unsigned char* data() const { return bytes; }
+        size_t size() const { return length; }
+
+    private:
+        mapped_file() = default;
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        const unsigned char* bytes = nullptr;
+        size_t length              = 0;
+    };
+
+    // the texels of a texture, bottom row first, or its blocks if
+    // compressed isn't 0, and where each level of its mipmap chain is: in
+    // pixels, one after the other, or in the file mapped to file
+    struct texture_data
+    {
+        texture_data() = default;
+        // moved only, levels point into pixels
+        texture_data(texture_data&&) = default;
+        texture_data& operator=(texture_data&&) = default;
+
+        bool empty() const { return levels.empty(); }
+
+        unsigned long width   = 0;
+        unsigned long height  = 0;
+        unsigned int channels = 4;
+        GLenum compressed     = 0;
+        std::vector<const unsigned char*> levels;
+        size_t bytes = 0; // of all levels
+        std::vector<unsigned char> pixels;
+        std::shared_ptr<mapped_file> file;
+    };
+
+    // a texture load_texture_async or load_texture_progressive fills in,
+    // the worker decoding it hands each new version over to swap_buffers
+    // through image
+    struct streamed_texture
+    {
+        texture_handle handle = 0;
+        std::mutex mutex;
+        // under mutex: newest version not uploaded yet
+        texture_data image;
+        bool done      = false; // no more versions will come
+        bool cancelled = false; // released or the engine shuts down
+        bool failed    = false; // the file can't be opened or decoded
+        // GL thread only: the version being uploaded, some rows of it each
+        // swap_buffers as the upload budget allows
+        texture_data uploading;
+        unsigned int level_uploading = 0;
+        unsigned long rows_uploaded  = 0; // of that level, or rows of blocks
+        // is the texture width x height already, is a version complete?
+        bool allocated = false;
+        bool shown     = false;
+    };
+
+    // a buffer of the ring streamed rows are staged in, with the fence of
+    // the last upload from it, null once that is known to be done
+    struct pixel_buffer
+    {
+        GLuint name  = 0;
+        GLsync fence = nullptr;
+    };
+
+    // a texture of the cache, shared by every load of its file
+    struct cached_texture
+    {
+        std::string path; // canonical, the key of the cache
+        unsigned int references = 0;
+        unsigned long long bytes = 0; // of the texels uploaded
+        // how its mipmaps were made, for a reload after an eviction
+        mip_filter filter = mip_filter::none;
+        // when it was last drawn or loaded, the least recent is evicted
+        // first
+        unsigned long long last_used = 0;
+        bool evicted = false; // its name kept, its storage given back
+        bool failed  = false; // its streaming ended without an image
+    };
+
     class Engine : public IEngine
     {
         SDL_Window* window      = nullptr;
         SDL_GLContext glContext = nullptr;
         GLuint shader_program   = 0;
+        // decodes textures for load_textures, created on first use
+        std::unique_ptr<worker_pool> loader_pool;
+        // textures still being decoded or uploaded
+        std::vector<std::shared_ptr<streamed_texture>> streaming;
+        // what swap_buffers uploads of them at most each frame, 0 for no
+        // limit
+        size_t upload_budget_bytes = 0;
+        float upload_budget_ms     = 0.f;
+        // what textures loaded from now on get as mipmaps
+        mip_filter texture_mip_filter = mip_filter::none;
+        // the ring of pixel buffers rows are staged in, created on first
+        // use, and the one to use next
+        std::vector<pixel_buffer> pixel_buffers;
+        size_t next_pixel_buffer = 0;
+        texture_upload_stats upload_stats;
+        // channels of the textures uploaded with fewer than 4, which the
+        // fragment shader expands to RGBA, or placeholder_channels for a
+        // streamed one not uploaded yet or an evicted one
+        std::map<texture_handle, int> texture_channels;
+        // the texture cache: canonical path to texture, paths as given to
+        // their canonical one, kept until uninit_engine, so a repeated
+        // load is two lookups without touching the file system
+        std::unordered_map<std::string, texture_handle> texture_paths;
+        std::unordered_map<std::string, std::string> texture_aliases;
+        std::map<texture_handle, cached_texture> cached_textures;
+        texture_cache_stats texture_stats;
+        // texel bytes the cache keeps in GPU memory at most, 0 for no
+        // limit, and the count of draws and loads last_used is taken from
+        unsigned long long texture_budget = 0;
+        unsigned long long texture_uses   = 0;
+        // sprites of the loaded atlases by the key of their path, and the
+        // references to the pages they are on
+        std::unordered_map<std::string, atlas_region> atlas_regions;
+        std::vector<texture_handle> atlas_pages;
+        // what draw_texture bound last, render draws with it
+        texture_handle drawn_texture = 0;
 
         const std::map<std::string, uint> defined_options{
             { ge::timer, SDL_INIT_TIMER },
@@ -116,6 +330,25 @@ namespace ge
                                     const triangle& trDest,
                                     float alpha) override;
         void draw_texture(const std::string& path) override;
+        void draw_texture(texture_handle handle) override;
+        texture_handle load_texture(const std::string& path) override;
+        void release_texture(texture_handle handle) override;
+        texture_cache_stats get_texture_cache_stats() override;
+        bool load_atlas(const std::string& manifest_path) override;
+        bool find_atlas_region(const std::string& path,
+                               atlas_region& region) override;
+        std::vector<texture_handle>
+        load_textures(const std::vector<std::string>& paths) override;
+        texture_handle
+        load_texture_progressive(const std::string& path) override;
+        texture_handle load_texture_async(const std::string& path) override;
+        bool texture_ready(texture_handle handle) override;
+        bool texture_failed(texture_handle handle) override;
+        void set_upload_budget(size_t bytes_per_frame,
+                               float ms_per_frame) override;
+        texture_upload_stats get_texture_upload_stats() override;
+        void set_mip_filter(mip_filter filter) override;
+        void set_texture_budget(unsigned long long bytes) override;
 
     private:
         uint parseWndOptions(std::string init_options);
@@ -125,16 +358,58 @@ namespace ge
         bind_key* check_input(SDL_Keycode check_code);
         bind_event* check_event(Uint32 check_event);
         void fill_background();
+        void bind_drawn_texture();
         vertex
         blend_vertex(const vertex& first, const vertex& second, float alpha);
-        std::vector<unsigned char> load_file(const std::string& path);
-        std::vector<unsigned char> load_texture(const std::string& path,
-                                                unsigned long& width,
-                                                unsigned long& height);
-        std::vector<unsigned char>
-        reverse_image(const std::vector<unsigned char>& image,
-                      unsigned long width,
-                      unsigned long height);
+        texture_data decode_texture(const std::string& path,
+                                    mip_filter filter);
+        static bool decode_dds(const std::shared_ptr<mapped_file>& file,
+                               texture_data& data);
+        static bool map_baked(const std::shared_ptr<mapped_file>& file,
+                              texture_data& data);
+        static void decode_levels(const unsigned char* const* blocks,
+                                  unsigned int levels,
+                                  block_format format,
+                                  texture_data& data);
+        static void point_levels(texture_data& data, unsigned int levels);
+        static void touch_pages(const texture_data& data);
+        texture_handle upload_texture(const texture_data& data);
+        void fill_texture(GLuint texName, const texture_data& data);
+        static void texture_format(unsigned int channels,
+                                   GLenum& format,
+                                   GLint& internal_format);
+        static size_t level_bytes(const texture_data& data,
+                                  unsigned int level);
+        static void set_texture_levels(unsigned int levels);
+        void set_texture_channels(texture_handle handle,
+                                  unsigned int channels);
+        std::string texture_key(const std::string& path);
+        texture_handle reference_texture(const std::string& key);
+        void cache_texture(texture_handle handle,
+                           const std::string& key,
+                           unsigned long long bytes,
+                           mip_filter filter);
+        void evict_textures(texture_handle keep);
+        void reload_texture(texture_handle handle, cached_texture& cached);
+        worker_pool& loaders();
+        std::shared_ptr<streamed_texture>
+        start_streaming(const std::string& key, mip_filter filter);
+        static void stream_texture(streamed_texture& texture,
+                                   const std::string& path);
+        void decode_streamed(std::shared_ptr<streamed_texture> texture,
+                             const std::string& path,
+                             mip_filter filter);
+        void upload_streamed();
+        void upload_rows(streamed_texture& texture, size_t bytes);
+        void sub_image(GLint level,
+                       unsigned long y,
+                       unsigned long width,
+                       unsigned long rows,
+                       GLenum format,
+                       GLenum compressed,
+                       const unsigned char* pixels,
+                       size_t bytes);
+        void delete_pixel_buffers();
     };
 
     std::istream& operator>>(std::istream& is, vertex& v)
@@ -370,6 +645,7 @@ namespace ge
             SDL_GL_SwapWindow(window);
             fill_background();
         }
+        upload_streamed();
     }
 
     std::string Engine::init_engine(std::string init_options)
@@ -586,6 +862,28 @@ namespace ge
 
     void Engine::uninit_engine()
     {
+        for (const std::shared_ptr<streamed_texture>& texture : streaming)
+        {
+            std::lock_guard<std::mutex> lock(texture->mutex);
+            texture->cancelled = true;
+        }
+        loader_pool.reset();
+        streaming.clear();
+        delete_pixel_buffers();
+        upload_stats = texture_upload_stats();
+        for (const auto& cached : cached_textures)
+        {
+            GLuint texName = cached.first;
+            glDeleteTextures(1, &texName);
+        }
+        atlas_regions.clear();
+        atlas_pages.clear();
+        drawn_texture = 0;
+        cached_textures.clear();
+        texture_paths.clear();
+        texture_aliases.clear();
+        texture_channels.clear();
+        texture_stats = texture_cache_stats();
         glDeleteProgram(shader_program);
         if (window != nullptr)
         {
@@ -602,129 +900,1357 @@ namespace ge
 
     void Engine::draw_texture(const std::string& path)
     {
-        unsigned long width             = 0;
-        unsigned long height            = 0;
-        std::vector<unsigned char> text = load_texture(path, width, height);
+        // the first draw of a path takes the reference, the ones after
+        // only find the texture
+        const auto cached = texture_paths.find(texture_key(path));
+        texture_handle handle = 0;
+        if (cached != texture_paths.end())
+        {
+            handle = cached->second;
+            ++texture_stats.hits;
+        }
+        else
+        {
+            handle = load_texture(path);
+        }
+
+        if (handle != 0)
+            draw_texture(handle);
+    }
+
+    void Engine::draw_texture(texture_handle handle)
+    {
+        const auto cached = cached_textures.find(handle);
+        if (cached != cached_textures.end())
+        {
+            cached->second.last_used = ++texture_uses;
+            if (cached->second.evicted)
+                reload_texture(handle, cached->second);
+        }
+
+        drawn_texture = handle;
+        bind_drawn_texture();
+    }
+
+    // binds the texture of the last draw_texture and sets its uniforms,
+    // again after anything else the engine binds, so render keeps drawing
+    // it
+    void Engine::bind_drawn_texture()
+    {
+        // tell which texture unit need using
+        glActiveTexture(GL_TEXTURE0);
+
+        glBindTexture(GL_TEXTURE_2D, drawn_texture);
+        GE_GL_CHECK();
+
+        // send texture unit to shader uniform
+        GLint location = glGetUniformLocation(shader_program, "s_texture");
+        GE_GL_CHECK();
+        int text_unit = 0;
+
+        glUniform1i(location, text_unit);
+        GE_GL_CHECK();
+
+        // 0 for textures sampled as they are
+        const auto channels = texture_channels.find(drawn_texture);
+        location = glGetUniformLocation(shader_program, "s_channels");
+        GE_GL_CHECK();
+        glUniform1i(location,
+                    channels != texture_channels.end() ? channels->second : 0);
+        GE_GL_CHECK();
+    }
+
+    texture_handle Engine::load_texture(const std::string& path)
+    {
+        const std::string key = texture_key(path);
+        texture_handle handle = reference_texture(key);
+        if (handle != 0)
+            return handle;
+
+        ++texture_stats.misses;
+        texture_data data = decode_texture(path, texture_mip_filter);
+
+        if (data.empty())
+            return 0;
+
+        handle = upload_texture(data);
+        cache_texture(handle, key, data.bytes, texture_mip_filter);
+        return handle;
+    }
+
+    void Engine::release_texture(texture_handle handle)
+    {
+        const auto cached = cached_textures.find(handle);
+        if (cached == cached_textures.end() || --cached->second.references > 0)
+            return;
+
+        if (!cached->second.evicted)
+            texture_stats.resident_bytes -= cached->second.bytes;
+        texture_paths.erase(cached->second.path);
+        cached_textures.erase(cached);
+        texture_channels.erase(handle);
+
+        // a texture still being decoded is not waited for
+        for (size_t i = 0; i < streaming.size(); ++i)
+        {
+            if (streaming[i]->handle != handle)
+                continue;
+            std::lock_guard<std::mutex> lock(streaming[i]->mutex);
+            streaming[i]->cancelled = true;
+            streaming.erase(streaming.begin() + i);
+            break;
+        }
+
+        // GL binds 0 in place of a deleted texture
+        if (drawn_texture == handle)
+            drawn_texture = 0;
+        GLuint texName = handle;
+        glDeleteTextures(1, &texName);
+        GE_GL_CHECK();
+    }
+
+    texture_cache_stats Engine::get_texture_cache_stats()
+    {
+        texture_cache_stats stats = texture_stats;
+        stats.textures            = cached_textures.size();
+        for (const auto& cached : cached_textures)
+        {
+            if (!cached.second.evicted)
+                ++stats.resident_textures;
+        }
+        return stats;
+    }
+
+    bool Engine::load_atlas(const std::string& manifest_path)
+    {
+        std::ifstream manifest(manifest_path.c_str());
+        std::string tag;
+        int version = 0;
+        if (!(manifest >> tag >> version) || tag != "ge_atlas" || version != 1)
+        {
+            std::cerr << "File " << manifest_path << " is not an atlas manifest"
+                      << std::endl;
+            return false;
+        }
+
+        // page files are next to the manifest
+        const size_t slash    = manifest_path.find_last_of("/\\");
+        const std::string dir = slash == std::string::npos
+                                    ? std::string()
+                                    : manifest_path.substr(0, slash + 1);
+
+        std::vector<texture_handle> pages;
+        std::vector<vertex> page_sizes;
+        std::unordered_map<std::string, atlas_region> regions;
+        bool failed = false;
+        std::string kind;
+        while (!failed && manifest >> kind)
+        {
+            if (kind == "page")
+            {
+                vertex size;
+                std::string name;
+                manifest >> size.x >> size.y;
+                std::getline(manifest >> std::ws, name);
+                texture_handle page = manifest ? load_texture(dir + name) : 0;
+                failed = page == 0;
+                pages.push_back(page);
+                page_sizes.push_back(size);
+            }
+            else if (kind == "sprite")
+            {
+                size_t page  = 0;
+                float x      = 0;
+                float y      = 0;
+                float width  = 0;
+                float height = 0;
+                int rotated  = 0;
+                std::string path;
+                manifest >> page >> x >> y >> width >> height >> rotated;
+                std::getline(manifest >> std::ws, path);
+                failed = !manifest || page >= pages.size();
+                if (failed)
+                    break;
+
+                // the rectangle is counted from the top row, texture
+                // coordinates from the bottom one
+                const vertex& size        = page_sizes[page];
+                const float placed_width  = rotated ? height : width;
+                const float placed_height = rotated ? width : height;
+                atlas_region region;
+                region.page    = pages[page];
+                region.rotated = rotated != 0;
+                region.min.x   = x / size.x;
+                region.max.x   = (x + placed_width) / size.x;
+                region.max.y   = 1.f - y / size.y;
+                region.min.y   = 1.f - (y + placed_height) / size.y;
+                regions[texture_key(path)] = region;
+            }
+            else
+            {
+                failed = true;
+            }
+        }
+
+        if (failed)
+        {
+            std::cerr << "Atlas " << manifest_path << " can't be loaded"
+                      << std::endl;
+            for (texture_handle page : pages)
+                release_texture(page);
+            return false;
+        }
+
+        atlas_pages.insert(atlas_pages.end(), pages.begin(), pages.end());
+        for (const auto& region : regions)
+            atlas_regions[region.first] = region.second;
+        return true;
+    }
+
+    bool Engine::find_atlas_region(const std::string& path,
+                                   atlas_region& region)
+    {
+        const auto found = atlas_regions.find(texture_key(path));
+        if (found == atlas_regions.end())
+            return false;
+        region = found->second;
+        return true;
+    }
+
+    void remap_tex_coords(const atlas_region& region, texture& tx)
+    {
+        const float width  = region.max.x - region.min.x;
+        const float height = region.max.y - region.min.y;
+        for (vertex& v : tx.tex_coords)
+        {
+            const vertex sprite = v;
+            if (region.rotated)
+            {
+                // turned clockwise, the left edge of the sprite is on top
+                v.x = region.min.x + sprite.y * width;
+                v.y = region.max.y - sprite.x * height;
+            }
+            else
+            {
+                v.x = region.min.x + sprite.x * width;
+                v.y = region.min.y + sprite.y * height;
+            }
+        }
+    }
+
+    std::vector<texture_handle>
+    Engine::load_textures(const std::vector<std::string>& paths)
+    {
+        std::vector<texture_handle> handles(paths.size(), 0);
+        std::vector<texture_data> decoded(paths.size());
+        std::deque<size_t> ready;
+        std::mutex ready_mutex;
+        std::condition_variable ready_cv;
+
+        // cached files and repeated ones are not decoded, first[i] is the
+        // first path of the batch naming the same file as paths[i]
+        std::vector<std::string> keys(paths.size());
+        std::vector<size_t> first(paths.size());
+        std::unordered_map<std::string, size_t> batch;
+        size_t jobs = 0;
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            keys[i]    = texture_key(paths[i]);
+            handles[i] = reference_texture(keys[i]);
+            first[i]   = batch.emplace(keys[i], i).first->second;
+            if (handles[i] != 0 || first[i] != i)
+                continue;
+
+            ++texture_stats.misses;
+            ++jobs;
+            const mip_filter filter = texture_mip_filter;
+            loaders().add_job([&, i, filter] {
+                decoded[i] = decode_texture(paths[i], filter);
+                // notify under the lock, the waiting call may return and
+                // destroy ready_cv as soon as it sees the last index
+                std::lock_guard<std::mutex> lock(ready_mutex);
+                ready.push_back(i);
+                ready_cv.notify_one();
+            });
+        }
+
+        // GL calls stay on this thread, each texture is uploaded as soon as
+        // a worker has decoded it
+        for (size_t uploaded = 0; uploaded < jobs; ++uploaded)
+        {
+            size_t i = 0;
+            {
+                std::unique_lock<std::mutex> lock(ready_mutex);
+                ready_cv.wait(lock, [&ready] { return !ready.empty(); });
+                i = ready.front();
+                ready.pop_front();
+            }
+
+            if (!decoded[i].empty())
+            {
+                handles[i] = upload_texture(decoded[i]);
+                cache_texture(
+                    handles[i], keys[i], decoded[i].bytes, texture_mip_filter);
+            }
+            decoded[i] = texture_data();
+        }
+
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            if (handles[i] == 0 && first[i] != i)
+                handles[i] = reference_texture(keys[i]);
+        }
+
+        return handles;
+    }
+
+    texture_handle Engine::load_texture_progressive(const std::string& path)
+    {
+        // DDS and baked files have nothing to show until read whole
+        for (const std::string extension : { ".dds", ".btex" })
+        {
+            if (path.size() > extension.size() &&
+                path.compare(path.size() - extension.size(),
+                             extension.size(),
+                             extension) == 0)
+                return load_texture_async(path);
+        }
+
+        const std::string key = texture_key(path);
+        texture_handle cached = reference_texture(key);
+        if (cached != 0)
+            return cached;
+
+        ++texture_stats.misses;
+        std::shared_ptr<streamed_texture> texture =
+            start_streaming(key, mip_filter::none);
+        loaders().add_job([texture, path] { stream_texture(*texture, path); });
+        return texture->handle;
+    }
+
+    texture_handle Engine::load_texture_async(const std::string& path)
+    {
+        const std::string key = texture_key(path);
+        texture_handle cached = reference_texture(key);
+        if (cached != 0)
+            return cached;
+
+        ++texture_stats.misses;
+        const mip_filter filter = texture_mip_filter;
+        std::shared_ptr<streamed_texture> texture =
+            start_streaming(key, filter);
+        decode_streamed(texture, path, filter);
+        return texture->handle;
+    }
+
+    // decodes the whole of path on a loader thread and hands it to
+    // swap_buffers in one version
+    void Engine::decode_streamed(std::shared_ptr<streamed_texture> texture,
+                                 const std::string& path,
+                                 mip_filter filter)
+    {
+        loaders().add_job([this, texture, path, filter] {
+            {
+                std::lock_guard<std::mutex> lock(texture->mutex);
+                if (texture->cancelled)
+                    return;
+            }
+            texture_data data = decode_texture(path, filter);
+            // a mapped file is read from the disk here, swap_buffers only
+            // copies from it
+            touch_pages(data);
+
+            std::lock_guard<std::mutex> lock(texture->mutex);
+            texture->failed = data.empty();
+            texture->image  = std::move(data);
+            texture->done   = true;
+        });
+    }
+
+    bool Engine::texture_ready(texture_handle handle)
+    {
+        for (const std::shared_ptr<streamed_texture>& texture : streaming)
+        {
+            if (texture->handle == handle)
+                return false;
+        }
+        return true;
+    }
+
+    bool Engine::texture_failed(texture_handle handle)
+    {
+        const auto cached = cached_textures.find(handle);
+        return cached != cached_textures.end() && cached->second.failed;
+    }
+
+    void Engine::set_upload_budget(size_t bytes_per_frame, float ms_per_frame)
+    {
+        upload_budget_bytes = bytes_per_frame;
+        upload_budget_ms    = ms_per_frame;
+    }
+
+    texture_upload_stats Engine::get_texture_upload_stats()
+    {
+        return upload_stats;
+    }
+
+    void Engine::set_mip_filter(mip_filter filter)
+    {
+        texture_mip_filter = filter;
+    }
+
+    void Engine::set_texture_budget(unsigned long long bytes)
+    {
+        texture_budget = bytes;
+        evict_textures(0);
+    }
+
+    std::shared_ptr<streamed_texture>
+    Engine::start_streaming(const std::string& key, mip_filter filter)
+    {
+        std::shared_ptr<streamed_texture> texture =
+            std::make_shared<streamed_texture>();
+
+        GLuint texName;
+        glGenTextures(1, &texName);
+        GE_GL_CHECK();
+        glBindTexture(GL_TEXTURE_2D, texName);
+        GE_GL_CHECK();
 
-        if (text.empty())
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        GE_GL_CHECK();
+
+        // the fragment shader draws the placeholder until the first version
+        // is uploaded, whatever rows of it the texture has by then
+        texture->handle           = texName;
+        texture_channels[texName] = placeholder_channels;
+        cache_texture(texName, key, 0, filter);
+        streaming.push_back(texture);
+        bind_drawn_texture();
+        return texture;
+    }
+
+    void Engine::stream_texture(streamed_texture& texture,
+                                const std::string& path)
+    {
+        std::ifstream file(path.c_str(), std::ios::binary);
+        if (!file.is_open())
+        {
+            std::cerr << "File " << path << " can't be opened" << std::endl;
+            std::lock_guard<std::mutex> lock(texture.mutex);
+            texture.failed = true;
+            texture.done   = true;
             return;
+        }
+
+        // read a piece at a time, so an interlaced image is shown after the
+        // first pass of it is read rather than all of the file
+        bool convert_to_rgba32 = true;
+        bool verify_checksums  = true;
+        bool bottom_up         = true;
+        picopng::StreamDecoder decoder(convert_to_rgba32, verify_checksums);
+        std::vector<char> piece(64 * 1024);
+        std::vector<unsigned char> image;
+        bool cancelled = false;
+        while (!decoder.finished() && decoder.error() == 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock(texture.mutex);
+                cancelled = texture.cancelled;
+            }
+            if (cancelled)
+                break;
+
+            file.read(&piece.front(), piece.size());
+            const size_t size = static_cast<size_t>(file.gcount());
+            if (size == 0)
+                break;
+            decoder.feed(reinterpret_cast<unsigned char*>(&piece.front()),
+                         size);
+            if (!decoder.header_ready())
+                continue;
+
+            const picopng::PNG::Info& info = decoder.info();
+            const size_t row_bytes         = decoder.row_bytes();
+            image.resize(row_bytes * info.height);
+            if (info.interlaceMethod)
+            {
+                // each pass is published, swap_buffers uploads the newest
+                while (decoder.poll_pass(&image.front(), bottom_up) != 0)
+                {
+                    std::lock_guard<std::mutex> lock(texture.mutex);
+                    texture.image.pixels.assign(image.begin(), image.end());
+                    texture.image.width  = info.width;
+                    texture.image.height = info.height;
+                    point_levels(texture.image, 1);
+                }
+            }
+            else
+            {
+                // rows come top first, GL wants the bottom one first
+                while (decoder.rows_polled() < info.height)
+                {
+                    unsigned long y = info.height - 1 - decoder.rows_polled();
+                    if (decoder.poll_rows(&image[y * row_bytes], 1) == 0)
+                        break;
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(texture.mutex);
+        if (!decoder.finished())
+        {
+            if (!cancelled)
+                std::cerr << "Function StreamDecoder failed" << std::endl;
+            texture.failed = !cancelled;
+        }
+        else if (!decoder.info().interlaceMethod)
+        {
+            // published once checked, the passes of an Adam7 image can't
+            // wait for that
+            texture.image.pixels.swap(image);
+            texture.image.width  = decoder.info().width;
+            texture.image.height = decoder.info().height;
+            point_levels(texture.image, 1);
+        }
+        texture.done = true;
+    }
+
+    void Engine::upload_streamed()
+    {
+        using clock                   = std::chrono::steady_clock;
+        const clock::time_point start = clock::now();
+        // a pixel buffer of rows at a time, so the time budget is looked at
+        // often
+        const size_t band_bytes = pixel_buffer_bytes;
+        size_t bytes_left       = std::numeric_limits<size_t>::max();
+        if (upload_budget_bytes != 0)
+            bytes_left = upload_budget_bytes;
+        bool in_budget = true;
+        bool uploaded  = false;
+
+        for (size_t i = 0; i < streaming.size();)
+        {
+            streamed_texture& texture = *streaming[i];
+            bool done                 = false;
+            bool failed               = false;
+            {
+                std::lock_guard<std::mutex> lock(texture.mutex);
+                // a newer version is uploaded instead, from its first row
+                if (!texture.image.empty())
+                {
+                    texture.uploading       = std::move(texture.image);
+                    texture.image           = texture_data();
+                    texture.level_uploading = 0;
+                    texture.rows_uploaded   = 0;
+                }
+                done   = texture.done && texture.image.empty();
+                failed = texture.failed;
+            }
+
+            while (in_budget && !texture.uploading.empty())
+            {
+                const size_t bytes = std::min(bytes_left, band_bytes);
+                upload_rows(texture, bytes);
+                uploaded = true;
+                bytes_left -= std::min(bytes_left, bytes);
+                const std::chrono::duration<float, std::milli> spent =
+                    clock::now() - start;
+                in_budget = bytes_left > 0 &&
+                            (upload_budget_ms <= 0.f ||
+                             spent.count() < upload_budget_ms);
+            }
+
+            if (done && texture.uploading.empty())
+            {
+                // a version that came with done was taken above already.
+                // A failed one stays drawn as the placeholder
+                const auto cached = cached_textures.find(texture.handle);
+                if (failed && cached != cached_textures.end())
+                    cached->second.failed = true;
+                streaming.erase(streaming.begin() + i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+        // the uploads bound their textures, the frame goes on drawing the
+        // one it drew, with the channels it may have now it is shown
+        if (uploaded)
+            bind_drawn_texture();
+        const std::chrono::duration<double, std::milli> spent =
+            clock::now() - start;
+        upload_stats.upload_ms += spent.count();
+    }
+
+    // uploads the next rows of the version being uploaded, as many as fit
+    // in bytes but at least one, rows of blocks of a compressed one
+    void Engine::upload_rows(streamed_texture& texture, size_t bytes)
+    {
+        const texture_data& data    = texture.uploading;
+        const unsigned int levels   = data.levels.size();
+        const unsigned int channels = data.channels;
+        GLenum format               = GL_RGBA;
+        GLint internal_format       = GL_RGBA8;
+        texture_format(channels, format, internal_format);
+
+        glBindTexture(GL_TEXTURE_2D, texture.handle);
+        GE_GL_CHECK();
+        if (!texture.allocated)
+        {
+            // filtered before level 0 is defined, so the driver can make
+            // room for the whole chain at once
+            set_texture_levels(levels);
+            for (unsigned int level = 0; level < levels; ++level)
+            {
+                if (data.compressed != 0)
+                {
+                    glCompressedTexImage2D(GL_TEXTURE_2D,
+                                           level,
+                                           data.compressed,
+                                           mip_size(data.width, level),
+                                           mip_size(data.height, level),
+                                           0,
+                                           level_bytes(data, level),
+                                           nullptr);
+                    continue;
+                }
+                glTexImage2D(GL_TEXTURE_2D,
+                             level,
+                             internal_format,
+                             mip_size(data.width, level),
+                             mip_size(data.height, level),
+                             0,
+                             format,
+                             GL_UNSIGNED_BYTE,
+                             nullptr);
+            }
+            GE_GL_CHECK();
+            texture.allocated = true;
+
+            const auto cached = cached_textures.find(texture.handle);
+            if (cached != cached_textures.end())
+            {
+                texture_stats.resident_bytes -= cached->second.bytes;
+                cached->second.bytes = data.bytes;
+                texture_stats.resident_bytes += cached->second.bytes;
+                evict_textures(texture.handle);
+            }
+            // the rows go to this texture, not the drawn one
+            glBindTexture(GL_TEXTURE_2D, texture.handle);
+            GE_GL_CHECK();
+        }
+
+        // a row of blocks is 4 rows of texels, the last one maybe fewer
+        const unsigned int level         = texture.level_uploading;
+        const unsigned long level_width  = mip_size(data.width, level);
+        const unsigned long level_height = mip_size(data.height, level);
+        const unsigned long texel_rows   = data.compressed != 0 ? 4 : 1;
+        const unsigned long level_rows =
+            (level_height + texel_rows - 1) / texel_rows;
+        const size_t row_bytes   = level_bytes(data, level) / level_rows;
+        const unsigned long rows = std::min<unsigned long>(
+            std::max<size_t>(bytes / row_bytes, 1),
+            level_rows - texture.rows_uploaded);
+        const unsigned long y = texture.rows_uploaded * texel_rows;
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        // later versions refine it in place, the storage stays
+        sub_image(level,
+                  y,
+                  level_width,
+                  std::min(rows * texel_rows, level_height - y),
+                  format,
+                  data.compressed,
+                  data.levels[level] + texture.rows_uploaded * row_bytes,
+                  rows * row_bytes);
+        texture.rows_uploaded += rows;
+        if (texture.rows_uploaded == level_rows && level + 1 < levels)
+        {
+            ++texture.level_uploading;
+            texture.rows_uploaded = 0;
+        }
+
+        if (texture.rows_uploaded == level_rows && level + 1 == levels)
+        {
+            texture.uploading = texture_data();
+            if (!texture.shown)
+            {
+                set_texture_channels(texture.handle, channels);
+                texture.shown = true;
+            }
+        }
+    }
+
+    // uploads rows of the bound texture, of texels in format or of blocks
+    // if compressed isn't 0. Where the driver has sync objects they are
+    // copied to the next pixel buffer of the ring and the upload from it is
+    // only queued, the texture is done with it by the time the ring comes
+    // round, unless the fence says otherwise
+    void Engine::sub_image(GLint level,
+                           unsigned long y,
+                           unsigned long width,
+                           unsigned long rows,
+                           GLenum format,
+                           GLenum compressed,
+                           const unsigned char* pixels,
+                           size_t bytes)
+    {
+        // from pixels, or an offset into the bound pixel buffer
+        auto upload = [&](const void* data) {
+            if (compressed != 0)
+            {
+                glCompressedTexSubImage2D(GL_TEXTURE_2D,
+                                          level,
+                                          0,
+                                          y,
+                                          width,
+                                          rows,
+                                          compressed,
+                                          bytes,
+                                          data);
+            }
+            else
+            {
+                glTexSubImage2D(GL_TEXTURE_2D,
+                                level,
+                                0,
+                                y,
+                                width,
+                                rows,
+                                format,
+                                GL_UNSIGNED_BYTE,
+                                data);
+            }
+        };
+
+        using clock      = std::chrono::steady_clock;
+        const bool fence = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+        const bool map   = GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range;
+        upload_stats.bytes += bytes;
+        if (fence && map && bytes <= pixel_buffer_bytes &&
+            pixel_buffers.empty())
+        {
+            pixel_buffers.resize(pixel_buffer_count);
+            for (pixel_buffer& buffer : pixel_buffers)
+            {
+                glGenBuffers(1, &buffer.name);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.name);
+                glBufferData(GL_PIXEL_UNPACK_BUFFER,
+                             pixel_buffer_bytes,
+                             nullptr,
+                             GL_STREAM_DRAW);
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            GE_GL_CHECK();
+            upload_stats.pixel_buffers = true;
+        }
+
+        void* staging = nullptr;
+        if (!pixel_buffers.empty() && bytes <= pixel_buffer_bytes)
+        {
+            pixel_buffer& buffer = pixel_buffers[next_pixel_buffer];
+            next_pixel_buffer = (next_pixel_buffer + 1) % pixel_buffers.size();
+            if (buffer.fence != nullptr)
+            {
+                const clock::time_point start = clock::now();
+                GLenum wait                   = GL_TIMEOUT_EXPIRED;
+                while (wait == GL_TIMEOUT_EXPIRED)
+                {
+                    const GLuint64 nanoseconds = 1000 * 1000;
+                    wait                       = glClientWaitSync(
+                        buffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, nanoseconds);
+                }
+                glDeleteSync(buffer.fence);
+                buffer.fence = nullptr;
+                const std::chrono::duration<double, std::milli> blocked =
+                    clock::now() - start;
+                upload_stats.blocked_ms += blocked.count();
+            }
+
+            // the fence was waited for, the driver needs not look again
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.name);
+            staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,
+                                       0,
+                                       bytes,
+                                       GL_MAP_WRITE_BIT |
+                                           GL_MAP_INVALIDATE_RANGE_BIT |
+                                           GL_MAP_UNSYNCHRONIZED_BIT);
+            if (staging != nullptr)
+            {
+                std::memcpy(staging, pixels, bytes);
+                // the contents are lost if unmapping fails, rare enough
+                // that the rows are simply uploaded from client memory
+                if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE)
+                    staging = nullptr;
+            }
+            if (staging != nullptr)
+            {
+                // from offset 0 of the buffer bound
+                upload(nullptr);
+                buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            GE_GL_CHECK();
+        }
+
+        if (staging == nullptr)
+        {
+            upload(pixels);
+            GE_GL_CHECK();
+        }
+    }
+
+    void Engine::delete_pixel_buffers()
+    {
+        for (pixel_buffer& buffer : pixel_buffers)
+        {
+            if (buffer.fence != nullptr)
+                glDeleteSync(buffer.fence);
+            glDeleteBuffers(1, &buffer.name);
+        }
+        pixel_buffers.clear();
+        next_pixel_buffer = 0;
+    }
+
+    worker_pool& Engine::loaders()
+    {
+        if (!loader_pool)
+        {
+            unsigned int cores = std::thread::hardware_concurrency();
+            loader_pool.reset(new worker_pool(cores != 0 ? cores : 1));
+        }
+        return *loader_pool;
+    }
 
+    texture_handle
+    Engine::upload_texture(const texture_data& data)
+    {
         // generate texture name
         GLuint texName;
         glGenTextures(1, &texName);
         GE_GL_CHECK();
 
-        // tell which texture unit need using
-        glActiveTexture(GL_TEXTURE0);
+        fill_texture(texName, data);
+        return texName;
+    }
+
+    // specifies the texture of texName as data, the name of a new texture
+    // or of one evicted
+    void Engine::fill_texture(GLuint texName, const texture_data& data)
+    {
+        GLenum format         = GL_RGBA;
+        GLint internal_format = GL_RGBA8;
+        texture_format(data.channels, format, internal_format);
 
         // create empty texture object and bind it with name
         glBindTexture(GL_TEXTURE_2D, texName);
         GE_GL_CHECK();
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        const unsigned int levels = data.levels.size();
+        set_texture_levels(levels);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-        // copy data to GPU texture object
-        GLint mip_level = 0;
-        GLint border    = 0;
-        glTexImage2D(GL_TEXTURE_2D,
-                     mip_level,
-                     GL_RGBA,
-                     width,
-                     height,
-                     border,
-                     GL_RGBA,
-                     GL_UNSIGNED_BYTE,
-                     &text.front());
+        // rows of fewer than 4 channels are not padded to 4 bytes
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
         GE_GL_CHECK();
 
-        // send texture unit to shader uniform
-        GLint location = glGetUniformLocation(shader_program, "s_texture");
+        // copy data to GPU texture object, level by level of the chain
+        GLint border = 0;
+        for (unsigned int level = 0; level < levels; ++level)
+        {
+            if (data.compressed != 0)
+            {
+                // blocks as they are, the driver has the format
+                glCompressedTexImage2D(GL_TEXTURE_2D,
+                                       level,
+                                       data.compressed,
+                                       mip_size(data.width, level),
+                                       mip_size(data.height, level),
+                                       border,
+                                       level_bytes(data, level),
+                                       data.levels[level]);
+                continue;
+            }
+            glTexImage2D(GL_TEXTURE_2D,
+                         level,
+                         internal_format,
+                         mip_size(data.width, level),
+                         mip_size(data.height, level),
+                         border,
+                         format,
+                         GL_UNSIGNED_BYTE,
+                         data.levels[level]);
+        }
         GE_GL_CHECK();
-        int text_unit = 0;
 
-        glUniform1i(location, text_unit);
+        set_texture_channels(texName, data.channels);
+        // a load between draws doesn't change what render draws
+        bind_drawn_texture();
+    }
+
+    void Engine::texture_format(unsigned int channels,
+                                GLenum& format,
+                                GLint& internal_format)
+    {
+        // R8 and RG8 need GL 3.0 or ARB_texture_rg, the fragment shader
+        // makes grey of them. Luminance textures are sampled as grey already
+        const bool rg   = GLEW_VERSION_3_0 || GLEW_ARB_texture_rg;
+        format          = channels == 3 ? GL_RGB : GL_RGBA;
+        internal_format = channels == 3 ? GL_RGB8 : GL_RGBA8;
+        if (channels == 1)
+        {
+            format          = rg ? GL_RED : GL_LUMINANCE;
+            internal_format = rg ? GL_R8 : GL_LUMINANCE8;
+        }
+        else if (channels == 2)
+        {
+            format          = rg ? GL_RG : GL_LUMINANCE_ALPHA;
+            internal_format = rg ? GL_RG8 : GL_LUMINANCE8_ALPHA8;
+        }
+    }
+
+    size_t Engine::level_bytes(const texture_data& data, unsigned int level)
+    {
+        const unsigned long width  = mip_size(data.width, level);
+        const unsigned long height = mip_size(data.height, level);
+        if (data.compressed == 0)
+            return size_t(width) * height * data.channels;
+        return blocks_size(width,
+                           height,
+                           data.compressed == GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                               ? block_format::bc1
+                               : block_format::bc3);
+    }
+
+    void Engine::point_levels(texture_data& data, unsigned int levels)
+    {
+        data.levels.resize(levels);
+        data.bytes = 0;
+        for (unsigned int level = 0; level < levels; ++level)
+        {
+            data.levels[level] = data.pixels.data() + data.bytes;
+            data.bytes += level_bytes(data, level);
+        }
+    }
+
+    void Engine::set_texture_levels(unsigned int levels)
+    {
+        // magnified textures stay sharp, minified ones are blended between
+        // the two nearest levels of their chain
+        glTexParameteri(GL_TEXTURE_2D,
+                        GL_TEXTURE_MIN_FILTER,
+                        levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
         GE_GL_CHECK();
     }
 
-    std::vector<unsigned char> Engine::load_texture(const std::string& path,
-                                                    unsigned long& width,
-                                                    unsigned long& height)
+    void Engine::set_texture_channels(texture_handle handle,
+                                      unsigned int channels)
+    {
+        const bool rg = GLEW_VERSION_3_0 || GLEW_ARB_texture_rg;
+        if (rg && channels < 3)
+            texture_channels[handle] = channels;
+        else
+            texture_channels.erase(handle);
+    }
+
+    std::string Engine::texture_key(const std::string& path)
     {
-        std::vector<unsigned char> buffer = load_file(path);
-        std::vector<unsigned char> image, reversed_image;
+        const auto alias = texture_aliases.find(path);
+        if (alias != texture_aliases.end())
+            return alias->second;
+
+#ifdef _WIN32
+        char* canonical = _fullpath(nullptr, path.c_str(), 0);
+#else
+        char* canonical = realpath(path.c_str(), nullptr);
+#endif
+        // a file that can't be found is not cached, nor is its path
+        if (canonical == nullptr)
+            return path;
+
+        std::string key(canonical);
+        std::free(canonical);
+        texture_aliases.emplace(path, key);
+        return key;
+    }
 
-        int error =
-            decodePNG(image, width, height, &buffer.front(), buffer.size());
+    texture_handle Engine::reference_texture(const std::string& key)
+    {
+        const auto cached = texture_paths.find(key);
+        if (cached == texture_paths.end())
+            return 0;
 
-        if (error != 0)
+        ++cached_textures[cached->second].references;
+        ++texture_stats.hits;
+        return cached->second;
+    }
+
+    void Engine::cache_texture(texture_handle handle,
+                               const std::string& key,
+                               unsigned long long bytes,
+                               mip_filter filter)
+    {
+        cached_texture& cached = cached_textures[handle];
+        cached.path            = key;
+        cached.references      = 1;
+        cached.bytes           = bytes;
+        cached.filter          = filter;
+        cached.last_used       = ++texture_uses;
+        texture_paths[key]     = handle;
+        texture_stats.resident_bytes += bytes;
+        evict_textures(handle);
+    }
+
+    // gives back the storage of the textures least recently used, but
+    // keep and the drawn one, until those left fit in the budget. Names
+    // stay, so handles do, and the textures are drawn transparent until
+    // reload_texture
+    void Engine::evict_textures(texture_handle keep)
+    {
+        if (texture_budget == 0 ||
+            texture_stats.resident_bytes <= texture_budget)
+            return;
+
+        // the textures still streaming are looked up once, not for each
+        // candidate, and the candidates sorted once, not scanned for each
+        // eviction
+        std::unordered_set<texture_handle> still_streaming;
+        for (const std::shared_ptr<streamed_texture>& texture : streaming)
+            still_streaming.insert(texture->handle);
+        typedef std::map<texture_handle, cached_texture>::iterator candidate;
+        std::vector<candidate> candidates;
+        for (auto it = cached_textures.begin(); it != cached_textures.end();
+             ++it)
+        {
+            const cached_texture& cached = it->second;
+            if (it->first == keep || it->first == drawn_texture ||
+                cached.evicted || cached.bytes == 0 ||
+                still_streaming.count(it->first) != 0)
+                continue;
+            candidates.push_back(it);
+        }
+        std::sort(candidates.begin(),
+                  candidates.end(),
+                  [](candidate a, candidate b) {
+                      return a->second.last_used < b->second.last_used;
+                  });
+
+        bool evicted = false;
+        for (candidate lru : candidates)
         {
-            std::cerr << "Function decodePNG failed" << std::endl;
+            if (texture_stats.resident_bytes <= texture_budget)
+                break;
+
+            // every level of the chain redefined empty
+            GLint max_level = 0;
+            glBindTexture(GL_TEXTURE_2D, lru->first);
+            glGetTexParameteriv(
+                GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &max_level);
+            for (GLint level = 0; level <= max_level; ++level)
+            {
+                glTexImage2D(GL_TEXTURE_2D,
+                             level,
+                             GL_RGBA8,
+                             0,
+                             0,
+                             0,
+                             GL_RGBA,
+                             GL_UNSIGNED_BYTE,
+                             nullptr);
+            }
+            GE_GL_CHECK();
+
+            texture_stats.resident_bytes -= lru->second.bytes;
+            lru->second.evicted          = true;
+            texture_channels[lru->first] = placeholder_channels;
+            ++texture_stats.evictions;
+            evicted = true;
         }
 
-        reversed_image = reverse_image(image, width, height);
+        if (evicted)
+            bind_drawn_texture();
+    }
 
-        return reversed_image;
+    // decodes an evicted texture again on the loader threads, swap_buffers
+    // uploads it as one of load_texture_async, so draw_texture doesn't
+    // wait for it. It is drawn transparent meanwhile
+    void Engine::reload_texture(texture_handle handle, cached_texture& cached)
+    {
+        ++texture_stats.reloads;
+        cached.evicted = false;
+        // not resident until upload_rows defines its storage again
+        cached.bytes = 0;
+
+        std::shared_ptr<streamed_texture> texture =
+            std::make_shared<streamed_texture>();
+        texture->handle = handle;
+        streaming.push_back(texture);
+        decode_streamed(texture, cached.path, cached.filter);
     }
 
-    std::vector<unsigned char>
-    Engine::reverse_image(const std::vector<unsigned char>& image,
-                          unsigned long width,
-                          unsigned long height)
+    texture_data Engine::decode_texture(const std::string& path,
+                                        mip_filter filter)
     {
-        std::vector<unsigned char> reversed_image;
+        texture_data data;
+        // decoded from a mapping of the file rather than a copy of it
+        std::shared_ptr<mapped_file> file = mapped_file::map(path);
+        if (!file)
+        {
+            std::cerr << "File " << path << " can't be opened" << std::endl;
+            return data;
+        }
+        const unsigned char* bytes = file->data();
+        const size_t size          = file->size();
+
+        // a baked file is uploaded from the mapping, with nothing to decode
+        if (size >= 4 && std::memcmp(bytes, "BTEX", 4) == 0)
+        {
+            if (!map_baked(file, data))
+            {
+                std::cerr << "File " << path << " is not a baked texture"
+                          << std::endl;
+                data = texture_data();
+            }
+            return data;
+        }
 
-        int values_in_row = width * 4;
-        reversed_image.reserve(image.size());
-        for (int row = height - 1; row >= 0; --row)
+        // a DDS file of tools/texture_compressor brings its chain along
+        if (size >= 4 && std::memcmp(bytes, "DDS ", 4) == 0)
         {
-            for (int curr_val = 0; curr_val < values_in_row; ++curr_val)
+            if (!decode_dds(file, data))
             {
-                reversed_image.push_back(image[curr_val + values_in_row * row]);
+                std::cerr << "File " << path
+                          << " is not a DDS file of BC1 or BC3 blocks"
+                          << std::endl;
+                data = texture_data();
             }
+            return data;
+        }
+
+        // GL wants the bottom row first, decodePNG writes it there directly.
+        // Checksums are verified so a damaged asset is not uploaded. Grey
+        // and RGB images keep their channels, a grey mask is a quarter of
+        // its RGBA size
+        bool bottom_up        = true;
+        bool verify_checksums = true;
+
+        // each thread, the loader pool workers above all, decodes with a
+        // decoder of its own that keeps its scratch memory for the next
+        // texture, but not that of a background
+        static thread_local picopng::PNG decoder;
+        const size_t keep_scratch = 4 * 1024 * 1024;
+
+        // with room for the mipmap chain after level 0, which the decode
+        // keeps, so the image is not moved to grow
+        picopng::Probe probe;
+        if (filter != mip_filter::none && probePNG(bytes, size, probe) == 0)
+        {
+            data.pixels.reserve(mip_offset(probe.width,
+                                           probe.height,
+                                           probe.channels,
+                                           mip_levels(probe.width,
+                                                      probe.height)));
+        }
+
+        int error = decodePNGChannels(decoder,
+                                      data.pixels,
+                                      data.width,
+                                      data.height,
+                                      data.channels,
+                                      bytes,
+                                      size,
+                                      bottom_up,
+                                      verify_checksums);
+        decoder.releaseScratch(keep_scratch);
+
+        if (error != 0)
+        {
+            std::cerr << "Function decodePNGChannels failed" << std::endl;
+            return texture_data();
         }
 
-        return reversed_image;
+        // on the loader thread too, the render thread only uploads
+        build_mip_chain(
+            data.pixels, data.width, data.height, data.channels, filter);
+        point_levels(data,
+                     filter != mip_filter::none
+                         ? mip_levels(data.width, data.height)
+                         : 1);
+        return data;
     }
 
-    std::vector<unsigned char> Engine::load_file(const std::string& path)
+    bool Engine::decode_dds(const std::shared_ptr<mapped_file>& file,
+                            texture_data& data)
     {
-        using namespace std;
-        vector<unsigned char> buffer;
+        dds_info info;
+        if (!read_dds_header(file->data(), file->size(), info))
+            return false;
 
-        ifstream file(path.c_str());
+        std::vector<const unsigned char*> levels(info.levels);
+        const unsigned char* blocks = file->data() + dds_header_bytes;
+        for (unsigned int level = 0; level < info.levels; ++level)
+        {
+            levels[level] = blocks;
+            blocks += blocks_size(mip_size(info.width, level),
+                                  mip_size(info.height, level),
+                                  info.format);
+        }
+        data.width  = info.width;
+        data.height = info.height;
 
-        if (!file.is_open())
+        // a driver with S3TC takes the blocks as they are, a quarter or an
+        // eighth of the memory of RGBA, others get texels decoded from them
+        if (!GLEW_EXT_texture_compression_s3tc)
         {
-            cerr << "File " << path << "can't be opened" << endl;
-            return buffer;
+            decode_levels(&levels.front(), info.levels, info.format, data);
+            return true;
         }
+        data.compressed = info.format == block_format::bc1
+                              ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                              : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        data.levels.swap(levels);
+        data.bytes = blocks - (file->data() + dds_header_bytes);
+        data.file  = file;
+        return true;
+    }
+
+    bool Engine::map_baked(const std::shared_ptr<mapped_file>& file,
+                           texture_data& data)
+    {
+        baked_info info;
+        if (!read_baked_header(file->data(), file->size(), info))
+            return false;
 
-        streamsize size = 0;
+        std::vector<const unsigned char*> levels;
+        size_t bytes = 0;
+        for (const baked_level& level : info.levels)
+        {
+            levels.push_back(file->data() + level.offset);
+            bytes += level.bytes;
+        }
+        data.width                  = info.width;
+        data.height                 = info.height;
+        const unsigned int channels = baked_channels(info.format);
+        const block_format blocks   = info.format == baked_format::bc1
+                                          ? block_format::bc1
+                                          : block_format::bc3;
+        if (channels == 0 && !GLEW_EXT_texture_compression_s3tc)
+        {
+            decode_levels(&levels.front(), levels.size(), blocks, data);
+            return true;
+        }
+        if (channels != 0)
+        {
+            data.channels = channels;
+        }
+        else
+        {
+            data.compressed = blocks == block_format::bc1
+                                  ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                                  : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        }
+        data.levels.swap(levels);
+        data.bytes = bytes;
+        data.file  = file;
+        return true;
+    }
 
-        file.seekg(0, ios::end);
-        if (!file.good())
+    // blocks of each level to RGBA texels in data, decoded on the loader
+    // thread as a PNG is
+    void Engine::decode_levels(const unsigned char* const* blocks,
+                               unsigned int levels,
+                               block_format format,
+                               texture_data& data)
+    {
+        data.channels   = 4;
+        data.compressed = 0;
+        data.pixels.resize(mip_offset(data.width, data.height, 4, levels));
+        for (unsigned int level = 0; level < levels; ++level)
         {
-            cerr << "Can't change pointer location to end" << endl;
-            return buffer;
+            decode_blocks(
+                blocks[level],
+                mip_size(data.width, level),
+                mip_size(data.height, level),
+                format,
+                &data.pixels[mip_offset(data.width, data.height, 4, level)]);
         }
-        size = file.tellg();
+        point_levels(data, levels);
+    }
 
-        file.seekg(0, ios::beg);
-        if (!file.good())
+    void Engine::touch_pages(const texture_data& data)
+    {
+        // a byte of each page faults it in, if it isn't in memory already
+        if (!data.file)
+            return;
+        unsigned char touched = 0;
+        for (size_t level = 0; level < data.levels.size(); ++level)
         {
-            cerr << "Can't change pointer location to begin" << endl;
-            return buffer;
+            const volatile unsigned char* page = data.levels[level];
+            const size_t bytes = level_bytes(data, level);
+            for (size_t offset = 0; offset < bytes; offset += baked_alignment)
+                touched ^= page[offset];
         }
-        size -= file.tellg();
+        static_cast<void>(touched);
+    }
 
-        if (size > 0)
+    std::shared_ptr<mapped_file> mapped_file::map(const std::string& path)
+    {
+        std::shared_ptr<mapped_file> file(new mapped_file());
+#ifdef _WIN32
+        HANDLE handle = CreateFileA(path.c_str(),
+                                    GENERIC_READ,
+                                    FILE_SHARE_READ,
+                                    nullptr,
+                                    OPEN_EXISTING,
+                                    FILE_FLAG_SEQUENTIAL_SCAN,
+                                    nullptr);
+        if (handle == INVALID_HANDLE_VALUE)
+            return nullptr;
+        LARGE_INTEGER size;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(handle, &size) && size.QuadPart > 0)
         {
-            buffer.resize(size);
-            file.read(reinterpret_cast<char*>(&buffer.front()), size);
+            mapping = CreateFileMappingA(
+                handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
         }
+        CloseHandle(handle);
+        if (mapping == nullptr)
+            return nullptr;
+        // the view keeps the mapping
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (view == nullptr)
+            return nullptr;
+        file->length = static_cast<size_t>(size.QuadPart);
+#else
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return nullptr;
+        struct stat info;
+        void* view = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+            view = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (view == MAP_FAILED)
+            return nullptr;
+        file->length = static_cast<size_t>(info.st_size);
+#endif
+        file->bytes = static_cast<const unsigned char*>(view);
+        return file;
+    }
 
-        return buffer;
+    mapped_file::~mapped_file()
+    {
+        if (bytes == nullptr)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(bytes);
+#else
+        munmap(const_cast<unsigned char*>(bytes), length);
+#endif
     }
 
     IEngine* getInstance()
@@ -17,7 +17,8 @@ int main(int /*argn*/, char* /*args*/ [])
     }
 
     const std::string text_path = "./textures/texture.png";
-    gameEngine->draw_texture(text_path);
+    ge::texture_handle texture  = gameEngine->load_texture(text_path);
+    gameEngine->draw_texture(texture);
 
     bool run_loop = true;
     ge::event event;
@@ -67,6 +68,7 @@ int main(int /*argn*/, char* /*args*/ [])
 
         gameEngine->swap_buffers();
     }
+    gameEngine->release_texture(texture);
     gameEngine->uninit_engine();
     return EXIT_SUCCESS;
 }
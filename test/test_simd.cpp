@@ -0,0 +1,348 @@
+#include "../include/mipmap.hpp"
+#include "../include/picopng.hxx"
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// checks every SIMD kernel the CPU can run against the scalar code it stands
+// in for, on random data: the unfilter kernels against PNG::unFilterScanline,
+// in place and out of place, the convert kernels against PNG::convert, the
+// CRC-32 and Adler-32 ones against PNG::crc32 and Zlib::adler32, and the box
+// kernels of the mipmaps against mip_level. The kernel tables are emptied
+// first, so those run their scalar code. Prints what failed and what the CPU
+// can't run, and fails if any kernel gave other bytes
+namespace
+{
+    std::mt19937 random_engine(20261016);
+    int failures = 0;
+
+    std::vector<unsigned char> random_bytes(size_t size)
+    {
+        std::uniform_int_distribution<int> byte(0, 255);
+        std::vector<unsigned char> bytes(size);
+        for (unsigned char& b : bytes)
+            b = static_cast<unsigned char>(byte(random_engine));
+        return bytes;
+    }
+
+    void check(bool same, const std::string& what)
+    {
+        if (same)
+            return;
+        ++failures;
+        std::cerr << "FAIL " << what << std::endl;
+    }
+
+    void skip(const char* kernel)
+    {
+        std::cout << "skipped " << kernel << ", the CPU can't run it"
+                  << std::endl;
+    }
+
+#ifdef PICOPNG_X86_SIMD
+    struct unfilter_case
+    {
+        const char* name;
+        picopng::UnfilterKernel kernel;
+        unsigned long filter;
+        bool supported;
+        bool any_bytewidth; // up, the others take 3 and 4 only
+    };
+
+    void test_unfilter()
+    {
+        const bool ssse3                       = SDL_HasSSE41();
+        const std::vector<unfilter_case> cases = {
+            { "upSSE2", picopng::simd::upSSE2, 2, SDL_HasSSE2(), true },
+            { "upAVX2", picopng::simd::upAVX2, 2, SDL_HasAVX2(), true },
+            { "subSSE2", picopng::simd::subSSE2, 1, SDL_HasSSE2(), false },
+            { "avgSSE2", picopng::simd::avgSSE2, 3, SDL_HasSSE2(), false },
+            { "paethSSE2", picopng::simd::paethSSE2, 4, SDL_HasSSE2(), false },
+            { "paethSSSE3", picopng::simd::paethSSSE3, 4, ssse3, false }
+        };
+        picopng::PNG png;
+        png.error = 0;
+        for (const unfilter_case& c : cases)
+        {
+            if (!c.supported)
+            {
+                skip(c.name);
+                continue;
+            }
+            for (size_t bytewidth = 1; bytewidth <= 8; ++bytewidth)
+            {
+                if (!c.any_bytewidth && bytewidth != 3 && bytewidth != 4)
+                    continue;
+                for (size_t pixels = 1; pixels <= 80; ++pixels)
+                {
+                    const size_t length = pixels * bytewidth;
+                    const std::vector<unsigned char> scanline =
+                        random_bytes(length);
+                    const std::vector<unsigned char> precon =
+                        random_bytes(length);
+                    std::vector<unsigned char> expected(length);
+                    png.unFilterScanline(&expected[0],
+                                         &scanline[0],
+                                         &precon[0],
+                                         bytewidth,
+                                         c.filter,
+                                         length);
+
+                    std::vector<unsigned char> out(length);
+                    c.kernel(
+                        &out[0], &scanline[0], &precon[0], bytewidth, length);
+                    std::vector<unsigned char> in_place = scanline;
+                    c.kernel(&in_place[0],
+                             &in_place[0],
+                             &precon[0],
+                             bytewidth,
+                             length);
+                    const std::string what = std::string(c.name) +
+                                             " bytewidth " +
+                                             std::to_string(bytewidth) +
+                                             " length " +
+                                             std::to_string(length);
+                    check(out == expected, what);
+                    check(in_place == expected, what + " in place");
+                }
+            }
+        }
+    }
+
+    // PNG::convert of numpixels 8-bit pixels as info says, with the scalar
+    // code, and the error it gave
+    std::vector<unsigned char> convert(const picopng::PNG::Info& info,
+                                       const std::vector<unsigned char>& in,
+                                       size_t numpixels,
+                                       int& error)
+    {
+        picopng::PNG png;
+        png.error = 0;
+        std::vector<unsigned char> out(4 * numpixels);
+        error = png.convert(&out[0], &in[0], info, numpixels, 1);
+        return out;
+    }
+
+    void test_convert()
+    {
+        picopng::PNG::Info info;
+        info.bitDepth    = 8;
+        info.key_defined = false;
+        info.key_r = info.key_g = info.key_b = 0;
+        const bool sse2  = SDL_HasSSE2();
+        const bool ssse3 = SDL_HasSSE41();
+        const bool avx2  = SDL_HasAVX2();
+        if (!sse2)
+            skip("greySSE2 and greyKeySSE2");
+        if (!ssse3)
+            skip("rgbSSSE3, rgbKeySSSE3 and greyAlphaSSSE3");
+        if (!avx2)
+            skip("paletteAVX2");
+
+        for (size_t numpixels = 1; numpixels <= 100; ++numpixels)
+        {
+            const std::string size = " pixels " + std::to_string(numpixels);
+            int error              = 0;
+            std::vector<unsigned char> out(4 * numpixels);
+
+            // a key of a value the pixels have, so some turn transparent
+            std::vector<unsigned char> grey = random_bytes(numpixels);
+            std::vector<unsigned char> rgb  = random_bytes(3 * numpixels);
+            std::vector<unsigned char> ga   = random_bytes(2 * numpixels);
+            for (size_t i = 0; i < numpixels; i += 3)
+            {
+                grey[i]        = 77;
+                rgb[3 * i]     = 1;
+                rgb[3 * i + 1] = 2;
+                rgb[3 * i + 2] = 3;
+            }
+            if (sse2)
+            {
+                info.colorType   = 0;
+                info.key_defined = false;
+                std::vector<unsigned char> expected =
+                    convert(info, grey, numpixels, error);
+                picopng::simd::greySSE2(&out[0], &grey[0], numpixels);
+                check(out == expected, "greySSE2" + size);
+
+                info.key_defined = true;
+                info.key_r       = 77;
+                expected         = convert(info, grey, numpixels, error);
+                picopng::simd::greyKeySSE2(&out[0], &grey[0], numpixels, 77);
+                check(out == expected, "greyKeySSE2" + size);
+            }
+            if (ssse3)
+            {
+                info.colorType   = 2;
+                info.key_defined = false;
+                std::vector<unsigned char> expected =
+                    convert(info, rgb, numpixels, error);
+                picopng::simd::rgbSSSE3(&out[0], &rgb[0], numpixels);
+                check(out == expected, "rgbSSSE3" + size);
+
+                info.key_defined = true;
+                info.key_r       = 1;
+                info.key_g       = 2;
+                info.key_b       = 3;
+                expected         = convert(info, rgb, numpixels, error);
+                picopng::simd::rgbKeySSSE3(
+                    &out[0], &rgb[0], numpixels, 1 | 2 << 8 | 3 << 16);
+                check(out == expected, "rgbKeySSSE3" + size);
+
+                info.colorType   = 4;
+                info.key_defined = false;
+                expected         = convert(info, ga, numpixels, error);
+                picopng::simd::greyAlphaSSSE3(&out[0], &ga[0], numpixels);
+                check(out == expected, "greyAlphaSSSE3" + size);
+            }
+            if (avx2)
+            {
+                // indices past the palette are left to the scalar code,
+                // which fails with error 46
+                info.colorType   = 3;
+                info.key_defined = false;
+                info.palette     = random_bytes(4 * 200);
+                std::vector<unsigned char> indices = random_bytes(numpixels);
+                for (unsigned char& index : indices)
+                    index %= 200;
+                std::vector<unsigned char> expected =
+                    convert(info, indices, numpixels, error);
+                check(picopng::simd::paletteAVX2(&out[0],
+                                                 &indices[0],
+                                                 numpixels,
+                                                 &info.palette[0],
+                                                 info.palette.size()) &&
+                          error == 0 && out == expected,
+                      "paletteAVX2" + size);
+
+                indices[numpixels - 1] = 200;
+                convert(info, indices, numpixels, error);
+                check(!picopng::simd::paletteAVX2(&out[0],
+                                                  &indices[0],
+                                                  numpixels,
+                                                  &info.palette[0],
+                                                  info.palette.size()) &&
+                          error == 46,
+                      "paletteAVX2 index out of range" + size);
+            }
+        }
+    }
+
+    void test_checksums()
+    {
+        const bool pclmul = picopng::simd::hasPCLMUL();
+        const bool ssse3  = SDL_HasSSE41();
+        if (!pclmul)
+            skip("crc32PCLMUL");
+        if (!ssse3)
+            skip("adler32SSSE3");
+        const std::vector<unsigned char> data = random_bytes(20000);
+        const size_t sizes[] = { 0, 1, 15, 16, 31, 64, 80, 100, 1000, 5552,
+                                 5553, 11104, 20000 };
+        for (size_t size : sizes)
+        {
+            const std::string what = " size " + std::to_string(size);
+            // from the start of a stream and carried on from one
+            for (unsigned long start : { 0ul, 0x12345678ul })
+            {
+                const size_t folded = size & ~size_t(15);
+                if (pclmul && folded >= 64)
+                    check(picopng::simd::crc32PCLMUL(start, &data[0], folded) ==
+                              picopng::PNG::crc32(start, &data[0], folded),
+                          "crc32PCLMUL" + what);
+            }
+            for (unsigned long start : { 1ul, 0xfff0fff0ul })
+            {
+                if (ssse3)
+                    check(picopng::simd::adler32SSSE3(start, &data[0], size) ==
+                              picopng::Zlib::adler32(start, &data[0], size),
+                          "adler32SSSE3" + what);
+            }
+        }
+    }
+#endif
+
+    // mip_level with the box kernel against it without, over sizes odd
+    // and even and rows shorter and longer than a step of the kernels
+    void test_box(const char* name, ge::box_kernel kernel)
+    {
+        for (unsigned int channels = 1; channels <= 4; ++channels)
+        {
+            for (unsigned long width = 1; width <= 70; ++width)
+            {
+                const unsigned long height = 1 + width % 5;
+                const std::vector<unsigned char> in =
+                    random_bytes(size_t(width) * height * channels);
+                const unsigned long out_width  = ge::mip_size(width, 1);
+                const unsigned long out_height = ge::mip_size(height, 1);
+                std::vector<unsigned char> expected(
+                    size_t(out_width) * out_height * channels);
+                std::vector<unsigned char> out(expected.size());
+
+                ge::mip_box_kernel() = nullptr;
+                ge::mip_level(&expected[0],
+                              out_width,
+                              out_height,
+                              &in[0],
+                              width,
+                              height,
+                              channels,
+                              ge::mip_filter::box);
+                ge::mip_box_kernel() = kernel;
+                ge::mip_level(&out[0],
+                              out_width,
+                              out_height,
+                              &in[0],
+                              width,
+                              height,
+                              channels,
+                              ge::mip_filter::box);
+                check(out == expected,
+                      std::string(name) + " channels " +
+                          std::to_string(channels) + " width " +
+                          std::to_string(width));
+            }
+        }
+        ge::mip_box_kernel() = nullptr;
+    }
+}
+
+int main()
+{
+    // the scalar code is the reference, the kernels are called directly
+    picopng::unfilterKernels() = picopng::UnfilterKernels();
+    picopng::convertKernels()  = picopng::ConvertKernels();
+    picopng::checksumKernels() = picopng::ChecksumKernels();
+    ge::mip_box_kernel()       = nullptr;
+
+#ifdef PICOPNG_X86_SIMD
+    test_unfilter();
+    test_convert();
+    test_checksums();
+#else
+    skip("every picopng kernel");
+#endif
+#ifdef GE_MIPMAP_X86_SIMD
+    if (SDL_HasSSE41())
+        test_box("box_ssse3", ge::simd::box_ssse3);
+    else
+        skip("box_ssse3");
+    if (SDL_HasAVX2())
+        test_box("box_avx2", ge::simd::box_avx2);
+    else
+        skip("box_avx2");
+#else
+    skip("every mipmap kernel");
+#endif
+
+    if (failures != 0)
+    {
+        std::cerr << failures << " checks failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "every kernel gives the bytes of the scalar code"
+              << std::endl;
+    return EXIT_SUCCESS;
+}
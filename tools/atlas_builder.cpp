@@ -0,0 +1,427 @@
+#include "../include/picopng.hxx"
+#include "png_encoder.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// packs PNG sprites into a few atlas pages with the MaxRects algorithm and
+// writes the pages next to a manifest, which Engine::load_atlas reads to find
+// the page and rectangle of each sprite by its path. Sprites can be kept apart
+// by padding, get their edge pixels extruded so filtering does not blend in
+// their neighbours, and be turned 90 degrees where that packs them better.
+//
+// The manifest is text: a "ge_atlas 1" line, then for each page
+//   page <width> <height> <file name next to the manifest>
+// and for each sprite, with the rectangle of its pixels in the page counted
+// from the top left, before any turn
+//   sprite <page> <x> <y> <width> <height> <turned clockwise 0/1> <path>
+namespace
+{
+    struct options
+    {
+        unsigned long page_size = 2048;
+        unsigned long padding   = 2;
+        unsigned long extrude   = 0;
+        bool rotate             = false;
+    };
+
+    struct rect
+    {
+        unsigned long x;
+        unsigned long y;
+        unsigned long width;
+        unsigned long height;
+    };
+
+    struct sprite
+    {
+        std::string path;
+        unsigned long width  = 0; // of the PNG
+        unsigned long height = 0;
+        size_t page          = 0;
+        rect placed          = rect{ 0, 0, 0, 0 }; // in the page, turned
+        bool rotated         = false; // turned 90 degrees clockwise
+    };
+
+    // the free space of a page as the largest free rectangles, which overlap
+    // each other. A cell goes where its bottom edge is lowest, which keeps
+    // the used part of the page compact for cutting it down, then where it
+    // leaves the shortest side free
+    class max_rects
+    {
+    public:
+        max_rects(unsigned long width, unsigned long height)
+            : free_rects{ rect{ 0, 0, width, height } }
+        {
+        }
+
+        // where a width x height cell fits best, turned if rotate lets it
+        // and it fits better so, false if it fits nowhere
+        bool find(unsigned long width,
+                  unsigned long height,
+                  bool rotate,
+                  rect& cell,
+                  bool& rotated) const
+        {
+            unsigned long best_bottom = ULONG_MAX;
+            unsigned long best_short  = ULONG_MAX;
+            unsigned long best_long   = ULONG_MAX;
+            for (const rect& r : free_rects)
+            {
+                for (int turn = 0; turn < (rotate ? 2 : 1); ++turn)
+                {
+                    const unsigned long w = turn ? height : width;
+                    const unsigned long h = turn ? width : height;
+                    if (w > r.width || h > r.height)
+                        continue;
+                    const unsigned long short_side =
+                        std::min(r.width - w, r.height - h);
+                    const unsigned long long_side =
+                        std::max(r.width - w, r.height - h);
+                    const unsigned long bottom = r.y + h;
+                    if (bottom < best_bottom ||
+                        (bottom == best_bottom &&
+                         (short_side < best_short ||
+                          (short_side == best_short && long_side < best_long))))
+                    {
+                        best_bottom = bottom;
+                        best_short  = short_side;
+                        best_long   = long_side;
+                        cell        = rect{ r.x, r.y, w, h };
+                        rotated     = turn != 0;
+                    }
+                }
+            }
+            return best_bottom != ULONG_MAX;
+        }
+
+        void place(const rect& cell)
+        {
+            // what is left of each free rectangle the cell overlaps, on
+            // its four sides
+            std::vector<rect> split;
+            for (const rect& r : free_rects)
+            {
+                if (!overlap(r, cell))
+                {
+                    split.push_back(r);
+                    continue;
+                }
+                const unsigned long r_right     = r.x + r.width;
+                const unsigned long r_bottom    = r.y + r.height;
+                const unsigned long cell_right  = cell.x + cell.width;
+                const unsigned long cell_bottom = cell.y + cell.height;
+                if (cell.x > r.x)
+                    split.push_back(rect{ r.x, r.y, cell.x - r.x, r.height });
+                if (cell_right < r_right)
+                    split.push_back(rect{
+                        cell_right, r.y, r_right - cell_right, r.height });
+                if (cell.y > r.y)
+                    split.push_back(rect{ r.x, r.y, r.width, cell.y - r.y });
+                if (cell_bottom < r_bottom)
+                    split.push_back(rect{
+                        r.x, cell_bottom, r.width, r_bottom - cell_bottom });
+            }
+
+            // those inside another one are not the largest
+            free_rects.clear();
+            for (size_t i = 0; i < split.size(); ++i)
+            {
+                bool inside = false;
+                for (size_t j = 0; j < split.size() && !inside; ++j)
+                {
+                    inside = j != i && contains(split[j], split[i]) &&
+                             (j < i || !contains(split[i], split[j]));
+                }
+                if (!inside)
+                    free_rects.push_back(split[i]);
+            }
+        }
+
+    private:
+        static bool overlap(const rect& a, const rect& b)
+        {
+            return a.x < b.x + b.width && b.x < a.x + a.width &&
+                   a.y < b.y + b.height && b.y < a.y + a.height;
+        }
+
+        static bool contains(const rect& outer, const rect& inner)
+        {
+            return inner.x >= outer.x && inner.y >= outer.y &&
+                   inner.x + inner.width <= outer.x + outer.width &&
+                   inner.y + inner.height <= outer.y + outer.height;
+        }
+
+        std::vector<rect> free_rects;
+    };
+
+    struct page
+    {
+        max_rects space;
+        unsigned long width; // used so far, with the extruded pixels
+        unsigned long height;
+    };
+
+    // places every sprite, largest first, on the first page it fits on,
+    // opening pages as needed. A cell is the sprite with its extruded
+    // border and its padding on the right and bottom, which may hang over
+    // the edge of the page
+    bool pack(std::vector<sprite>& sprites,
+              std::vector<page>& pages,
+              const options& opts)
+    {
+        std::vector<sprite*> order;
+        for (sprite& s : sprites)
+            order.push_back(&s);
+        std::stable_sort(order.begin(), order.end(), [](sprite* a, sprite* b) {
+            return std::max(a->width, a->height) >
+                       std::max(b->width, b->height) ||
+                   (std::max(a->width, a->height) ==
+                        std::max(b->width, b->height) &&
+                    std::min(a->width, a->height) >
+                        std::min(b->width, b->height));
+        });
+
+        const unsigned long border = 2 * opts.extrude + opts.padding;
+        const unsigned long space  = opts.page_size + opts.padding;
+        for (sprite* s : order)
+        {
+            if (std::max(s->width, s->height) + border > space)
+            {
+                std::cerr << s->path << " is too large for a "
+                          << opts.page_size << " page" << std::endl;
+                return false;
+            }
+
+            // a new page has room for any sprite
+            rect cell   = rect{ 0, 0, 0, 0 };
+            bool placed = false;
+            for (size_t p = 0; !placed; ++p)
+            {
+                if (p == pages.size())
+                    pages.push_back(page{ max_rects(space, space), 0, 0 });
+                placed = pages[p].space.find(s->width + border,
+                                             s->height + border,
+                                             opts.rotate,
+                                             cell,
+                                             s->rotated);
+                if (placed)
+                    s->page = p;
+            }
+
+            page& pg = pages[s->page];
+            pg.space.place(cell);
+            s->placed = rect{ cell.x + opts.extrude,
+                              cell.y + opts.extrude,
+                              s->rotated ? s->height : s->width,
+                              s->rotated ? s->width : s->height };
+            pg.width  = std::max(pg.width, cell.x + cell.width - opts.padding);
+            pg.height =
+                std::max(pg.height, cell.y + cell.height - opts.padding);
+        }
+
+        // pages are cut down to the power of two around what they hold
+        for (page& pg : pages)
+        {
+            unsigned long width = 1, height = 1;
+            while (width < pg.width)
+                width *= 2;
+            while (height < pg.height)
+                height *= 2;
+            pg.width  = std::min(width, opts.page_size);
+            pg.height = std::min(height, opts.page_size);
+        }
+        return true;
+    }
+
+    // copies an RGBA sprite into its page, then repeats its edge pixels
+    // over the extruded border
+    void blit(std::vector<unsigned char>& pixels,
+              unsigned long page_width,
+              const std::vector<unsigned char>& image,
+              const sprite& s,
+              unsigned long extrude)
+    {
+        const rect& r = s.placed;
+        auto at = [&](unsigned long x, unsigned long y) {
+            return &pixels[(y * page_width + x) * 4];
+        };
+        for (unsigned long y = 0; y < s.height; ++y)
+        {
+            for (unsigned long x = 0; x < s.width; ++x)
+            {
+                const unsigned char* from = &image[(y * s.width + x) * 4];
+                unsigned char* to = s.rotated ? at(r.x + s.height - 1 - y,
+                                                   r.y + x)
+                                              : at(r.x + x, r.y + y);
+                std::copy(from, from + 4, to);
+            }
+        }
+
+        for (unsigned long y = r.y; y < r.y + r.height; ++y)
+        {
+            for (unsigned long e = 1; e <= extrude; ++e)
+            {
+                std::copy(at(r.x, y), at(r.x, y) + 4, at(r.x - e, y));
+                std::copy(at(r.x + r.width - 1, y),
+                          at(r.x + r.width - 1, y) + 4,
+                          at(r.x + r.width - 1 + e, y));
+            }
+        }
+        const unsigned long left  = r.x - extrude;
+        const unsigned long bytes = (r.width + 2 * extrude) * 4;
+        for (unsigned long e = 1; e <= extrude; ++e)
+        {
+            std::copy(at(left, r.y), at(left, r.y) + bytes, at(left, r.y - e));
+            std::copy(at(left, r.y + r.height - 1),
+                      at(left, r.y + r.height - 1) + bytes,
+                      at(left, r.y + r.height - 1 + e));
+        }
+    }
+
+    bool parse_number(const char* text, unsigned long& value)
+    {
+        char* end = nullptr;
+        value     = std::strtoul(text, &end, 10);
+        return *text != '\0' && *end == '\0';
+    }
+
+    int usage()
+    {
+        std::cerr << "usage: atlas_builder [--size <page size>] "
+                     "[--padding <pixels>] [--extrude <pixels>] [--rotate]\n"
+                     "                     <manifest> <png>..."
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+}
+
+int main(int argn, char* args[])
+{
+    options opts;
+    int arg = 1;
+    for (; arg < argn && args[arg][0] == '-' && args[arg][1] == '-'; ++arg)
+    {
+        const std::string option = args[arg];
+        if (option == "--rotate")
+        {
+            opts.rotate = true;
+            continue;
+        }
+        unsigned long* value = option == "--size"
+                                   ? &opts.page_size
+                                   : option == "--padding"
+                                         ? &opts.padding
+                                         : option == "--extrude"
+                                               ? &opts.extrude
+                                               : nullptr;
+        if (value == nullptr || ++arg == argn ||
+            !parse_number(args[arg], *value))
+            return usage();
+    }
+    if (argn - arg < 2 || opts.page_size == 0)
+        return usage();
+
+    const std::string manifest_path = args[arg];
+    const size_t slash              = manifest_path.find_last_of("/\\");
+    const std::string dir =
+        slash == std::string::npos ? "" : manifest_path.substr(0, slash + 1);
+    std::string base = manifest_path.substr(dir.size());
+    base             = base.substr(0, base.find_last_of('.'));
+
+    // only the sizes are needed to pack, the pixels are decoded after
+    std::vector<sprite> sprites;
+    for (++arg; arg < argn; ++arg)
+    {
+        sprite s;
+        s.path = args[arg];
+        picopng::Probe probe;
+        int fd    = open(s.path.c_str(), O_RDONLY);
+        int error = fd < 0 ? -1 : probePNG(fd, probe);
+        if (fd >= 0)
+            close(fd);
+        if (error != 0)
+        {
+            std::cerr << "Can't read " << s.path << " (" << error << ")"
+                      << std::endl;
+            return EXIT_FAILURE;
+        }
+        s.width  = probe.width;
+        s.height = probe.height;
+        sprites.push_back(s);
+    }
+
+    std::vector<page> pages;
+    if (!pack(sprites, pages, opts))
+        return EXIT_FAILURE;
+
+    std::ofstream manifest(manifest_path);
+    manifest << "ge_atlas 1\n";
+    picopng::PNG decoder;
+    std::vector<unsigned char> png, image;
+    unsigned long long sprite_area = 0, page_area = 0;
+    for (size_t p = 0; p < pages.size(); ++p)
+    {
+        const std::string name = base + "_" + std::to_string(p) + ".png";
+        std::vector<unsigned char> pixels(pages[p].width * pages[p].height *
+                                          4);
+        for (const sprite& s : sprites)
+        {
+            if (s.page != p)
+                continue;
+            unsigned long width = 0, height = 0;
+            loadFile(png, s.path);
+            int error = decodePNG(decoder,
+                                  image,
+                                  width,
+                                  height,
+                                  png.empty() ? nullptr : &png.front(),
+                                  png.size());
+            if (error != 0 || width != s.width || height != s.height)
+            {
+                std::cerr << "Can't decode " << s.path << " (" << error
+                          << ")" << std::endl;
+                return EXIT_FAILURE;
+            }
+            blit(pixels, pages[p].width, image, s, opts.extrude);
+            sprite_area += 1ull * s.width * s.height;
+        }
+
+        ge::png_info info;
+        info.width  = pages[p].width;
+        info.height = pages[p].height;
+        std::ofstream file(dir + name, std::ios::binary);
+        png = ge::png_encoder::encode(pixels, info);
+        file.write(reinterpret_cast<const char*>(&png.front()), png.size());
+        if (!file.good())
+        {
+            std::cerr << "Can't write " << dir << name << std::endl;
+            return EXIT_FAILURE;
+        }
+        manifest << "page " << info.width << " " << info.height << " "
+                 << name << "\n";
+        page_area += 1ull * info.width * info.height;
+    }
+    for (const sprite& s : sprites)
+    {
+        manifest << "sprite " << s.page << " " << s.placed.x << " "
+                 << s.placed.y << " " << s.width << " " << s.height << " "
+                 << (s.rotated ? 1 : 0) << " " << s.path << "\n";
+    }
+    manifest.close();
+    if (!manifest.good())
+    {
+        std::cerr << "Can't write " << manifest_path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << sprites.size() << " sprites in " << pages.size()
+              << " pages, " << 100.0 * sprite_area / page_area
+              << "% of the page area used" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,334 @@
+#pragma once
+
+#include "../include/block_compression.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// a BC1 and BC3 encoder for the tools. Colors take the principal axis of the
+// texels of a block for their endpoints, which a least squares fit to the
+// chosen indices then refines while that lowers the error. Alpha takes the
+// range of the block, or the 6 value mode where 0 and 255 come for free
+namespace ge
+{
+    namespace bc
+    {
+        inline unsigned int pack565(const float color[3])
+        {
+            const int r = (int)std::lround(std::min(std::max(color[0], 0.f),
+                                                    255.f) * 31 / 255);
+            const int g = (int)std::lround(std::min(std::max(color[1], 0.f),
+                                                    255.f) * 63 / 255);
+            const int b = (int)std::lround(std::min(std::max(color[2], 0.f),
+                                                    255.f) * 31 / 255);
+            return (r << 11) | (g << 5) | b;
+        }
+
+        // indices of texels to the nearest of the four colors of
+        // endpoints c0 and c1, the squared error of them
+        inline unsigned int fit_indices(const unsigned char texels[64],
+                                        unsigned int        c0,
+                                        unsigned int        c1,
+                                        unsigned char       indices[16])
+        {
+            const unsigned char block[4] = {
+                (unsigned char)c0, (unsigned char)(c0 >> 8),
+                (unsigned char)c1, (unsigned char)(c1 >> 8)
+            };
+            unsigned char colors[4][4];
+            bc1_palette(block, colors, false);
+            unsigned int error = 0;
+            for (int t = 0; t < 16; ++t)
+            {
+                unsigned int best = ~0u;
+                for (unsigned char i = 0; i < 4; ++i)
+                {
+                    unsigned int d = 0;
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        const int e = texels[t * 4 + k] - colors[i][k];
+                        d += e * e;
+                    }
+                    if (d < best)
+                    {
+                        best       = d;
+                        indices[t] = i;
+                    }
+                }
+                error += best;
+            }
+            return error;
+        }
+
+        // the endpoints that fit indices best in the least squares sense,
+        // false when the indices don't tell them apart
+        inline bool fit_endpoints(const unsigned char texels[64],
+                                  const unsigned char indices[16],
+                                  unsigned int&       c0,
+                                  unsigned int&       c1)
+        {
+            // each texel is w * e0 + (1 - w) * e1
+            static const float weights[4] = { 1.f, 0.f, 2.f / 3, 1.f / 3 };
+            float aa = 0, ab = 0, bb = 0, ax[3] = {}, bx[3] = {};
+            for (int t = 0; t < 16; ++t)
+            {
+                const float a = weights[indices[t]], b = 1 - a;
+                aa += a * a;
+                ab += a * b;
+                bb += b * b;
+                for (int k = 0; k < 3; ++k)
+                {
+                    ax[k] += a * texels[t * 4 + k];
+                    bx[k] += b * texels[t * 4 + k];
+                }
+            }
+            const float det = aa * bb - ab * ab;
+            if (std::fabs(det) < 1e-6f)
+                return false;
+            float e0[3], e1[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                e0[k] = (ax[k] * bb - bx[k] * ab) / det;
+                e1[k] = (bx[k] * aa - ax[k] * ab) / det;
+            }
+            c0 = pack565(e0);
+            c1 = pack565(e1);
+            return true;
+        }
+
+        // the colors of 4x4 RGBA texels to 8 bytes, with four colors
+        inline void encode_colors(const unsigned char texels[64],
+                                  unsigned char       block[8])
+        {
+            float mean[3] = {};
+            for (int t = 0; t < 16; ++t)
+                for (int k = 0; k < 3; ++k)
+                    mean[k] += texels[t * 4 + k] / 16.f;
+            float cov[6] = {}; // rr rg rb gg gb bb
+            for (int t = 0; t < 16; ++t)
+            {
+                const float r = texels[t * 4] - mean[0];
+                const float g = texels[t * 4 + 1] - mean[1];
+                const float b = texels[t * 4 + 2] - mean[2];
+                cov[0] += r * r;
+                cov[1] += r * g;
+                cov[2] += r * b;
+                cov[3] += g * g;
+                cov[4] += g * b;
+                cov[5] += b * b;
+            }
+            // the principal axis by power iteration
+            float axis[3] = { 1.f, 1.f, 1.f };
+            for (int i = 0; i < 8; ++i)
+            {
+                const float x = cov[0] * axis[0] + cov[1] * axis[1] +
+                                cov[2] * axis[2];
+                const float y = cov[1] * axis[0] + cov[3] * axis[1] +
+                                cov[4] * axis[2];
+                const float z = cov[2] * axis[0] + cov[4] * axis[1] +
+                                cov[5] * axis[2];
+                const float length =
+                    std::max(std::max(std::fabs(x), std::fabs(y)),
+                             std::fabs(z));
+                if (length < 1e-6f)
+                    break;
+                axis[0] = x / length;
+                axis[1] = y / length;
+                axis[2] = z / length;
+            }
+            float low = 1e30f, high = -1e30f;
+            int lowest = 0, highest = 0;
+            for (int t = 0; t < 16; ++t)
+            {
+                const float d = texels[t * 4] * axis[0] +
+                                texels[t * 4 + 1] * axis[1] +
+                                texels[t * 4 + 2] * axis[2];
+                if (d < low)
+                {
+                    low    = d;
+                    lowest = t;
+                }
+                if (d > high)
+                {
+                    high    = d;
+                    highest = t;
+                }
+            }
+            float e0[3], e1[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                e0[k] = texels[highest * 4 + k];
+                e1[k] = texels[lowest * 4 + k];
+            }
+            unsigned int c0 = pack565(e0), c1 = pack565(e1);
+            unsigned char indices[16];
+            unsigned int error = fit_indices(texels, c0, c1, indices);
+            for (int i = 0; i < 2 && error > 0; ++i)
+            {
+                unsigned int f0 = 0, f1 = 0;
+                unsigned char refit[16];
+                if (!fit_endpoints(texels, indices, f0, f1))
+                    break;
+                const unsigned int refit_error =
+                    fit_indices(texels, f0, f1, refit);
+                if (refit_error >= error)
+                    break;
+                c0    = f0;
+                c1    = f1;
+                error = refit_error;
+                std::copy(refit, refit + 16, indices);
+            }
+
+            // four colors need the first endpoint the greater
+            if (c0 < c1)
+            {
+                std::swap(c0, c1);
+                for (unsigned char& index : indices)
+                    index ^= 1;
+            }
+            unsigned long bits = 0;
+            for (int t = 15; t >= 0; --t)
+                bits = (bits << 2) | (c0 == c1 ? 0 : indices[t]);
+            block[0] = (unsigned char)c0;
+            block[1] = (unsigned char)(c0 >> 8);
+            block[2] = (unsigned char)c1;
+            block[3] = (unsigned char)(c1 >> 8);
+            for (int i = 0; i < 4; ++i)
+                block[4 + i] = (unsigned char)(bits >> (8 * i));
+        }
+
+        // indices of the alphas of texels to the nearest of the values of
+        // endpoints a0 and a1, the squared error of them
+        inline unsigned int fit_alphas(const unsigned char texels[64],
+                                       unsigned char       a0,
+                                       unsigned char       a1,
+                                       unsigned char       indices[16])
+        {
+            const unsigned char endpoints[2] = { a0, a1 };
+            unsigned char alphas[8];
+            bc3_alphas(endpoints, alphas);
+            unsigned int error = 0;
+            for (int t = 0; t < 16; ++t)
+            {
+                unsigned int best = ~0u;
+                for (unsigned char i = 0; i < 8; ++i)
+                {
+                    const int e = texels[t * 4 + 3] - alphas[i];
+                    if (unsigned(e * e) < best)
+                    {
+                        best       = e * e;
+                        indices[t] = i;
+                    }
+                }
+                error += best;
+            }
+            return error;
+        }
+
+        // the alphas of 4x4 RGBA texels to 8 bytes
+        inline void encode_alphas(const unsigned char texels[64],
+                                  unsigned char       block[8])
+        {
+            // the range of all, and of those that are not 0 or 255
+            unsigned char low = 255, high = 0, inner_low = 255, inner_high = 0;
+            for (int t = 0; t < 16; ++t)
+            {
+                const unsigned char a = texels[t * 4 + 3];
+                low                   = std::min(low, a);
+                high                  = std::max(high, a);
+                if (a != 0 && a != 255)
+                {
+                    inner_low  = std::min(inner_low, a);
+                    inner_high = std::max(inner_high, a);
+                }
+            }
+            unsigned char a0 = high, a1 = low;
+            unsigned char indices[16];
+            unsigned int error = fit_alphas(texels, a0, a1, indices);
+            if (inner_low > inner_high)
+            {
+                inner_low  = 0;
+                inner_high = 0;
+            }
+            unsigned char six[16];
+            if (error > 0 &&
+                fit_alphas(texels, inner_low, inner_high, six) < error)
+            {
+                a0 = inner_low;
+                a1 = inner_high;
+                std::copy(six, six + 16, indices);
+            }
+
+            unsigned long long bits = 0;
+            for (int t = 15; t >= 0; --t)
+                bits = (bits << 3) | indices[t];
+            block[0] = a0;
+            block[1] = a1;
+            for (int i = 0; i < 6; ++i)
+                block[2 + i] = (unsigned char)(bits >> (8 * i));
+        }
+    }
+
+    // 4x4 RGBA texels, rows of 16 bytes, to a block of format
+    inline void encode_block(const unsigned char texels[64],
+                             block_format        format,
+                             unsigned char*      block)
+    {
+        if (format == block_format::bc3)
+        {
+            bc::encode_alphas(texels, block);
+            block += 8;
+        }
+        bc::encode_colors(texels, block);
+    }
+
+    // width x height RGBA texels to blocks of format, the rows of blocks
+    // shared out between threads. Blocks past an edge repeat its texels
+    inline std::vector<unsigned char> encode_blocks(const unsigned char* rgba,
+                                                    unsigned long width,
+                                                    unsigned long height,
+                                                    block_format  format,
+                                                    unsigned int  threads)
+    {
+        std::vector<unsigned char> blocks(blocks_size(width, height, format));
+        const unsigned long rows    = (height + 3) / 4;
+        const unsigned long columns = (width + 3) / 4;
+        const size_t bytes          = block_bytes(format);
+        auto encode_rows = [&](unsigned long first, unsigned long step) {
+            unsigned char texels[64];
+            for (unsigned long row = first; row < rows; row += step)
+            {
+                for (unsigned long column = 0; column < columns; ++column)
+                {
+                    for (unsigned long y = 0; y < 4; ++y)
+                    {
+                        for (unsigned long x = 0; x < 4; ++x)
+                        {
+                            const unsigned long ty =
+                                std::min(row * 4 + y, height - 1);
+                            const unsigned long tx =
+                                std::min(column * 4 + x, width - 1);
+                            std::copy(rgba + (ty * width + tx) * 4,
+                                      rgba + (ty * width + tx) * 4 + 4,
+                                      texels + (y * 4 + x) * 4);
+                        }
+                    }
+                    encode_block(texels,
+                                 format,
+                                 &blocks[(row * columns + column) * bytes]);
+                }
+            }
+        };
+
+        threads = std::max(1u, std::min<unsigned int>(threads, rows));
+        std::vector<std::thread> workers;
+        for (unsigned int t = 1; t < threads; ++t)
+            workers.emplace_back(encode_rows, t, threads);
+        encode_rows(0, threads);
+        for (std::thread& worker : workers)
+            worker.join();
+        return blocks;
+    }
+}
@@ -0,0 +1,711 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+
+// a small PNG writer for the tools and benchmarks, it makes no attempt at
+// the best compression but can emit every color type, bit depth, Adam7
+// interlacing and each kind of deflate block
+namespace ge
+{
+    enum class deflate_blocks
+    {
+        stored,
+        fixed,
+        dynamic
+    };
+
+    struct png_info
+    {
+        unsigned long width     = 0;
+        unsigned long height    = 0;
+        unsigned int color_type = 6;
+        unsigned int bit_depth  = 8;
+        bool interlaced         = false;
+        // rgb triplets, written as PLTE when not empty
+        std::vector<unsigned char> palette;
+        // written as tRNS when not empty
+        std::vector<unsigned char> transparency;
+    };
+
+    class png_encoder
+    {
+    public:
+        // samples holds the rows top first, each one packed as in a PNG
+        // scanline without the filter byte, so starting on a byte boundary
+        static std::vector<unsigned char>
+        encode(const std::vector<unsigned char>& samples,
+               const png_info& info,
+               deflate_blocks blocks = deflate_blocks::dynamic)
+        {
+            std::vector<unsigned char> png{ 137, 80, 78, 71, 13, 10, 26, 10 };
+
+            std::vector<unsigned char> ihdr;
+            put32(ihdr, info.width);
+            put32(ihdr, info.height);
+            ihdr.push_back(static_cast<unsigned char>(info.bit_depth));
+            ihdr.push_back(static_cast<unsigned char>(info.color_type));
+            ihdr.push_back(0); // deflate
+            ihdr.push_back(0); // adaptive filtering
+            ihdr.push_back(info.interlaced ? 1 : 0);
+            put_chunk(png, "IHDR", ihdr);
+            if (!info.palette.empty())
+                put_chunk(png, "PLTE", info.palette);
+            if (!info.transparency.empty())
+                put_chunk(png, "tRNS", info.transparency);
+
+            std::vector<unsigned char> zlib =
+                compress(filter(samples, info), blocks);
+            // split like common encoders do, decoders must join IDATs
+            const size_t idat_size = 65536;
+            for (size_t pos = 0; pos < zlib.size(); pos += idat_size)
+            {
+                size_t end = std::min(zlib.size(), pos + idat_size);
+                put_chunk(png,
+                          "IDAT",
+                          std::vector<unsigned char>(zlib.begin() + pos,
+                                                     zlib.begin() + end));
+            }
+            put_chunk(png, "IEND", std::vector<unsigned char>());
+            return png;
+        }
+
+        static size_t row_bytes(unsigned long width,
+                                unsigned int color_type,
+                                unsigned int bit_depth)
+        {
+            return (width * bits_per_pixel(color_type, bit_depth) + 7) / 8;
+        }
+
+        static unsigned int bits_per_pixel(unsigned int color_type,
+                                           unsigned int bit_depth)
+        {
+            static const unsigned int channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+            return channels[color_type] * bit_depth;
+        }
+
+        // zlib stream of data made only of the requested block kind
+        static std::vector<unsigned char>
+        compress(const std::vector<unsigned char>& data, deflate_blocks blocks)
+        {
+            std::vector<unsigned char> out{ 0x78, 0x9c };
+            bit_writer bits(out);
+            if (blocks == deflate_blocks::stored)
+            {
+                size_t pos = 0;
+                do
+                {
+                    size_t size = std::min<size_t>(65535, data.size() - pos);
+                    bits.put(pos + size == data.size() ? 1 : 0, 3);
+                    bits.align();
+                    out.push_back(size & 255);
+                    out.push_back(size >> 8);
+                    out.push_back(~size & 255);
+                    out.push_back((~size >> 8) & 255);
+                    out.insert(out.end(),
+                               data.begin() + pos,
+                               data.begin() + pos + size);
+                    pos += size;
+                } while (pos < data.size());
+            }
+            else
+            {
+                lz77 matcher(data);
+                std::vector<symbol> symbols;
+                bool last = false;
+                while (!last)
+                {
+                    last = matcher.next(symbols, 1 << 16);
+                    if (blocks == deflate_blocks::fixed)
+                        write_fixed_block(bits, symbols, last);
+                    else
+                        write_dynamic_block(bits, symbols, last);
+                }
+                bits.align();
+            }
+            unsigned long adler = adler32(data);
+            put32(out, adler);
+            return out;
+        }
+
+    private:
+        struct symbol
+        {
+            unsigned short litlen; // literal, or match length with a dist
+            unsigned short dist;
+        };
+
+        struct bit_writer
+        {
+            explicit bit_writer(std::vector<unsigned char>& _out) : out(_out)
+            {
+            }
+
+            void put(unsigned long value, unsigned int count)
+            {
+                bits |= value << used;
+                used += count;
+                while (used >= 8)
+                {
+                    out.push_back(bits & 255);
+                    bits >>= 8;
+                    used -= 8;
+                }
+            }
+
+            void align()
+            {
+                if (used != 0)
+                    put(0, 8 - used);
+            }
+
+            std::vector<unsigned char>& out;
+            unsigned long bits = 0;
+            unsigned int used  = 0;
+        };
+
+        // greedy matching over hash chains, good enough to make every
+        // length and distance code show up in real images
+        class lz77
+        {
+        public:
+            explicit lz77(const std::vector<unsigned char>& _data)
+                : data(_data), head(1 << 15, -1), prev(window, -1)
+            {
+            }
+
+            // appends up to count symbols, true once data is exhausted
+            bool next(std::vector<symbol>& symbols, size_t count)
+            {
+                symbols.clear();
+                const size_t size = data.size();
+                while (pos < size && symbols.size() < count)
+                {
+                    size_t best_len = 0, best_dist = 0;
+                    if (pos + 3 <= size)
+                    {
+                        size_t max_len = std::min<size_t>(258, size - pos);
+                        long candidate = head[hash(pos)];
+                        for (int chain = 0;
+                             chain < 32 && candidate >= 0 &&
+                             pos - static_cast<size_t>(candidate) <= window;
+                             ++chain)
+                        {
+                            size_t len = 0;
+                            while (len < max_len &&
+                                   data[candidate + len] == data[pos + len])
+                                ++len;
+                            if (len > best_len)
+                            {
+                                best_len  = len;
+                                best_dist = pos - candidate;
+                                if (len == max_len)
+                                    break;
+                            }
+                            candidate = prev[candidate % window];
+                        }
+                    }
+                    if (best_len >= 3)
+                    {
+                        symbols.push_back(
+                            symbol{ static_cast<unsigned short>(best_len),
+                                    static_cast<unsigned short>(best_dist) });
+                    }
+                    else
+                    {
+                        best_len = 1;
+                        symbols.push_back(symbol{ data[pos], 0 });
+                    }
+                    for (size_t end = pos + best_len; pos < end; ++pos)
+                    {
+                        if (pos + 3 <= size)
+                        {
+                            unsigned int h     = hash(pos);
+                            prev[pos % window] = head[h];
+                            head[h]            = static_cast<long>(pos);
+                        }
+                    }
+                }
+                return pos >= size;
+            }
+
+        private:
+            unsigned int hash(size_t at) const
+            {
+                return ((data[at] << 10) ^ (data[at + 1] << 5) ^
+                        data[at + 2]) &
+                       0x7fff;
+            }
+
+            static const size_t window = 32768;
+            const std::vector<unsigned char>& data;
+            std::vector<long> head;
+            std::vector<long> prev;
+            size_t pos = 0;
+        };
+
+        static const unsigned short* length_base()
+        {
+            static const unsigned short base[29] = {
+                3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+            };
+            return base;
+        }
+
+        static const unsigned short* dist_base()
+        {
+            static const unsigned short base[30] = {
+                1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+                33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+                1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385,
+                24577
+            };
+            return base;
+        }
+
+        static unsigned int length_code(unsigned int length)
+        {
+            return static_cast<unsigned int>(
+                std::upper_bound(length_base(), length_base() + 29, length) -
+                length_base() - 1);
+        }
+
+        static unsigned int dist_code(unsigned int dist)
+        {
+            return static_cast<unsigned int>(
+                std::upper_bound(dist_base(), dist_base() + 30, dist) -
+                dist_base() - 1);
+        }
+
+        static unsigned int length_extra(unsigned int code)
+        {
+            return code < 8 || code == 28 ? 0 : code / 4 - 1;
+        }
+
+        static unsigned int dist_extra(unsigned int code)
+        {
+            return code < 4 ? 0 : code / 2 - 1;
+        }
+
+        static void write_symbols(bit_writer& bits,
+                                  const std::vector<symbol>& symbols,
+                                  const std::vector<unsigned int>& lit_codes,
+                                  const std::vector<unsigned int>& lit_lens,
+                                  const std::vector<unsigned int>& dist_codes,
+                                  const std::vector<unsigned int>& dist_lens)
+        {
+            for (const symbol& s : symbols)
+            {
+                if (s.dist == 0)
+                {
+                    bits.put(lit_codes[s.litlen], lit_lens[s.litlen]);
+                    continue;
+                }
+                unsigned int lc = length_code(s.litlen);
+                bits.put(lit_codes[257 + lc], lit_lens[257 + lc]);
+                bits.put(s.litlen - length_base()[lc], length_extra(lc));
+                unsigned int dc = dist_code(s.dist);
+                bits.put(dist_codes[dc], dist_lens[dc]);
+                bits.put(s.dist - dist_base()[dc], dist_extra(dc));
+            }
+            bits.put(lit_codes[256], lit_lens[256]);
+        }
+
+        static void write_fixed_block(bit_writer& bits,
+                                      const std::vector<symbol>& symbols,
+                                      bool last)
+        {
+            std::vector<unsigned int> lit_lens(288, 8), dist_lens(30, 5);
+            std::fill(lit_lens.begin() + 144, lit_lens.begin() + 256, 9);
+            std::fill(lit_lens.begin() + 256, lit_lens.begin() + 280, 7);
+            bits.put(last ? 1 : 0, 1);
+            bits.put(1, 2);
+            write_symbols(bits,
+                          symbols,
+                          huffman_codes(lit_lens),
+                          lit_lens,
+                          huffman_codes(dist_lens),
+                          dist_lens);
+        }
+
+        static void write_dynamic_block(bit_writer& bits,
+                                        const std::vector<symbol>& symbols,
+                                        bool last)
+        {
+            std::vector<unsigned long> lit_freqs(286), dist_freqs(30);
+            for (const symbol& s : symbols)
+            {
+                if (s.dist == 0)
+                {
+                    ++lit_freqs[s.litlen];
+                    continue;
+                }
+                ++lit_freqs[257 + length_code(s.litlen)];
+                ++dist_freqs[dist_code(s.dist)];
+            }
+            lit_freqs[256] = 1;
+            std::vector<unsigned int> lit_lens = huffman_lengths(lit_freqs, 15);
+            std::vector<unsigned int> dist_lens =
+                huffman_lengths(dist_freqs, 15);
+
+            size_t hlit = 286, hdist = 30;
+            while (hlit > 257 && lit_lens[hlit - 1] == 0)
+                --hlit;
+            while (hdist > 1 && dist_lens[hdist - 1] == 0)
+                --hdist;
+
+            // run length code of both length lists, as one sequence
+            std::vector<unsigned int> lens(lit_lens.begin(),
+                                           lit_lens.begin() + hlit);
+            lens.insert(lens.end(),
+                        dist_lens.begin(),
+                        dist_lens.begin() + hdist);
+            std::vector<symbol> runs; // code length symbol, extra bits
+            for (size_t i = 0; i < lens.size();)
+            {
+                size_t run = 1;
+                while (i + run < lens.size() && lens[i + run] == lens[i])
+                    ++run;
+                unsigned short len = static_cast<unsigned short>(lens[i]);
+                if (len == 0 && run >= 11)
+                {
+                    run = std::min<size_t>(run, 138);
+                    runs.push_back(symbol{ 18, repeat(run - 11) });
+                }
+                else if (len == 0 && run >= 3)
+                {
+                    runs.push_back(symbol{ 17, repeat(run - 3) });
+                }
+                else if (len != 0 && run >= 4)
+                {
+                    runs.push_back(symbol{ len, 0 });
+                    run = std::min<size_t>(run - 1, 6);
+                    runs.push_back(symbol{ 16, repeat(run - 3) });
+                    ++run;
+                }
+                else
+                {
+                    run = 1;
+                    runs.push_back(symbol{ len, 0 });
+                }
+                i += run;
+            }
+
+            std::vector<unsigned long> clen_freqs(19);
+            for (const symbol& r : runs)
+                ++clen_freqs[r.litlen];
+            std::vector<unsigned int> clen_lens =
+                huffman_lengths(clen_freqs, 7);
+            std::vector<unsigned int> clen_codes = huffman_codes(clen_lens);
+            static const unsigned int order[19] = { 16, 17, 18, 0, 8,  7, 9,
+                                                    6,  10, 5,  11, 4, 12, 3,
+                                                    13, 2,  14, 1,  15 };
+            size_t hclen = 19;
+            while (hclen > 4 && clen_lens[order[hclen - 1]] == 0)
+                --hclen;
+
+            bits.put(last ? 1 : 0, 1);
+            bits.put(2, 2);
+            bits.put(hlit - 257, 5);
+            bits.put(hdist - 1, 5);
+            bits.put(hclen - 4, 4);
+            for (size_t i = 0; i < hclen; ++i)
+                bits.put(clen_lens[order[i]], 3);
+            static const unsigned int run_extra[3] = { 2, 3, 7 };
+            for (const symbol& r : runs)
+            {
+                bits.put(clen_codes[r.litlen], clen_lens[r.litlen]);
+                if (r.litlen >= 16)
+                    bits.put(r.dist, run_extra[r.litlen - 16]);
+            }
+            write_symbols(bits,
+                          symbols,
+                          huffman_codes(lit_lens),
+                          lit_lens,
+                          huffman_codes(dist_lens),
+                          dist_lens);
+        }
+
+        static unsigned short repeat(size_t count)
+        {
+            return static_cast<unsigned short>(count);
+        }
+
+        // code lengths of at most max_len bits, frequencies are flattened
+        // until the tree fits. At least two symbols get a code so that
+        // every decoder accepts the tree
+        static std::vector<unsigned int>
+        huffman_lengths(std::vector<unsigned long> freqs, unsigned int max_len)
+        {
+            size_t used = freqs.size() - std::count(freqs.begin(),
+                                                    freqs.end(),
+                                                    0ul);
+            for (size_t i = 0; used < 2; ++i)
+            {
+                if (freqs[i] == 0)
+                {
+                    freqs[i] = 1;
+                    ++used;
+                }
+            }
+
+            std::vector<unsigned int> lens(freqs.size());
+            for (;;)
+            {
+                std::vector<size_t> leaves;
+                for (size_t i = 0; i < freqs.size(); ++i)
+                    if (freqs[i] != 0)
+                        leaves.push_back(i);
+                std::stable_sort(leaves.begin(),
+                                 leaves.end(),
+                                 [&freqs](size_t a, size_t b) {
+                                     return freqs[a] < freqs[b];
+                                 });
+
+                // leaves first then inner nodes, which are made in order of
+                // weight, so two queues give the two lightest nodes
+                const size_t n = leaves.size();
+                std::vector<unsigned long> weight(2 * n - 1);
+                std::vector<size_t> parent(2 * n - 1);
+                for (size_t i = 0; i < n; ++i)
+                    weight[i] = freqs[leaves[i]];
+                size_t next_leaf = 0, next_inner = n;
+                for (size_t node = n; node < 2 * n - 1; ++node)
+                {
+                    for (int child = 0; child < 2; ++child)
+                    {
+                        size_t pick =
+                            next_leaf < n &&
+                                    (next_inner >= node ||
+                                     weight[next_leaf] <= weight[next_inner])
+                                ? next_leaf++
+                                : next_inner++;
+                        weight[node] += weight[pick];
+                        parent[pick] = node;
+                    }
+                }
+
+                std::vector<unsigned int> depth(2 * n - 1);
+                unsigned int longest = 0;
+                for (size_t node = 2 * n - 1; node-- > 0;)
+                {
+                    if (node != 2 * n - 2)
+                        depth[node] = depth[parent[node]] + 1;
+                    if (node < n)
+                    {
+                        lens[leaves[node]] = depth[node];
+                        longest            = std::max(longest, depth[node]);
+                    }
+                }
+                if (longest <= max_len)
+                    return lens;
+                for (unsigned long& f : freqs)
+                    if (f != 0)
+                        f = (f >> 1) | 1;
+            }
+        }
+
+        // canonical codes, bit reversed so that they can be written LSB first
+        static std::vector<unsigned int>
+        huffman_codes(const std::vector<unsigned int>& lens)
+        {
+            unsigned int count[16] = {}, next[16] = {};
+            for (unsigned int len : lens)
+                ++count[len];
+            count[0] = 0;
+            for (unsigned int bits = 1, code = 0; bits < 16; ++bits)
+            {
+                code       = (code + count[bits - 1]) << 1;
+                next[bits] = code;
+            }
+            std::vector<unsigned int> codes(lens.size());
+            for (size_t i = 0; i < lens.size(); ++i)
+            {
+                if (lens[i] == 0)
+                    continue;
+                unsigned int code = next[lens[i]]++, reversed = 0;
+                for (unsigned int b = 0; b < lens[i]; ++b)
+                    reversed |= ((code >> b) & 1) << (lens[i] - 1 - b);
+                codes[i] = reversed;
+            }
+            return codes;
+        }
+
+        // filter bytes and filtered rows of every pass, each row takes the
+        // filter with the smallest sum of absolute differences
+        static std::vector<unsigned char>
+        filter(const std::vector<unsigned char>& samples, const png_info& info)
+        {
+            const unsigned int bpp =
+                bits_per_pixel(info.color_type, info.bit_depth);
+            const size_t stride =
+                row_bytes(info.width, info.color_type, info.bit_depth);
+            std::vector<unsigned char> out;
+            if (!info.interlaced)
+            {
+                out.reserve((stride + 1) * info.height);
+                filter_pass(out, &samples[0], stride, info.height, bpp);
+                return out;
+            }
+
+            static const unsigned int start_x[7] = { 0, 4, 0, 2, 0, 1, 0 };
+            static const unsigned int start_y[7] = { 0, 0, 4, 0, 2, 0, 1 };
+            static const unsigned int step_x[7]  = { 8, 8, 4, 4, 2, 2, 1 };
+            static const unsigned int step_y[7]  = { 8, 8, 8, 4, 4, 2, 2 };
+            for (int p = 0; p < 7; ++p)
+            {
+                unsigned long w =
+                    (info.width + step_x[p] - 1 - start_x[p]) / step_x[p];
+                unsigned long h =
+                    (info.height + step_y[p] - 1 - start_y[p]) / step_y[p];
+                if (info.width <= start_x[p] || info.height <= start_y[p])
+                    continue;
+                size_t pass_stride =
+                    row_bytes(w, info.color_type, info.bit_depth);
+                std::vector<unsigned char> pass(pass_stride * h);
+                for (unsigned long y = 0; y < h; ++y)
+                {
+                    const unsigned char* src =
+                        &samples[(start_y[p] + y * step_y[p]) * stride];
+                    unsigned char* dst = &pass[y * pass_stride];
+                    for (unsigned long x = 0; x < w; ++x)
+                        copy_pixel(
+                            dst, x, src, start_x[p] + x * step_x[p], bpp);
+                }
+                filter_pass(out, &pass[0], pass_stride, h, bpp);
+            }
+            return out;
+        }
+
+        static void copy_pixel(unsigned char* dst,
+                               size_t dst_x,
+                               const unsigned char* src,
+                               size_t src_x,
+                               unsigned int bpp)
+        {
+            if (bpp >= 8)
+            {
+                std::copy(src + src_x * bpp / 8,
+                          src + (src_x + 1) * bpp / 8,
+                          dst + dst_x * bpp / 8);
+                return;
+            }
+            size_t src_bit = src_x * bpp, dst_bit = dst_x * bpp;
+            unsigned int mask = (1u << bpp) - 1;
+            unsigned int value =
+                (src[src_bit / 8] >> (8 - bpp - src_bit % 8)) & mask;
+            dst[dst_bit / 8] |= value << (8 - bpp - dst_bit % 8);
+        }
+
+        static void filter_pass(std::vector<unsigned char>& out,
+                                const unsigned char* rows,
+                                size_t stride,
+                                unsigned long height,
+                                unsigned int bpp)
+        {
+            const size_t left = std::max(1u, bpp / 8);
+            std::vector<unsigned char> zero(stride), best, candidate(stride);
+            for (unsigned long y = 0; y < height; ++y)
+            {
+                const unsigned char* row   = rows + y * stride;
+                const unsigned char* above = y ? row - stride : &zero[0];
+                unsigned long best_cost    = ~0ul;
+                unsigned char best_type    = 0;
+                for (unsigned char type = 0; type < 5; ++type)
+                {
+                    unsigned long cost = 0;
+                    for (size_t i = 0; i < stride; ++i)
+                    {
+                        int a = i >= left ? row[i - left] : 0;
+                        int b = above[i];
+                        int c = i >= left ? above[i - left] : 0;
+                        int predicted = type == 1   ? a
+                                        : type == 2 ? b
+                                        : type == 3 ? (a + b) / 2
+                                        : type == 4 ? paeth(a, b, c)
+                                                    : 0;
+                        candidate[i] =
+                            static_cast<unsigned char>(row[i] - predicted);
+                        cost +=
+                            std::abs(static_cast<signed char>(candidate[i]));
+                    }
+                    if (cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_type = type;
+                        best.swap(candidate);
+                        candidate.resize(stride);
+                    }
+                }
+                out.push_back(best_type);
+                out.insert(out.end(), best.begin(), best.end());
+            }
+        }
+
+        static int paeth(int a, int b, int c)
+        {
+            int p = a + b - c;
+            int pa = std::abs(p - a);
+            int pb = std::abs(p - b);
+            int pc = std::abs(p - c);
+            return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+        }
+
+        static unsigned long adler32(const std::vector<unsigned char>& data)
+        {
+            unsigned long s1 = 1, s2 = 0;
+            for (size_t i = 0; i < data.size();)
+            {
+                size_t end = std::min(data.size(), i + 5552);
+                for (; i < end; ++i)
+                {
+                    s1 += data[i];
+                    s2 += s1;
+                }
+                s1 %= 65521;
+                s2 %= 65521;
+            }
+            return (s2 << 16) | s1;
+        }
+
+        static unsigned long crc32(const std::vector<unsigned char>& data,
+                                   size_t begin)
+        {
+            static const std::vector<unsigned long> table = [] {
+                std::vector<unsigned long> t;
+                for (unsigned long n = 0; n < 256; ++n)
+                {
+                    unsigned long c = n;
+                    for (int k = 0; k < 8; ++k)
+                        c = c & 1 ? 0xedb88320ul ^ (c >> 1) : c >> 1;
+                    t.push_back(c);
+                }
+                return t;
+            }();
+            unsigned long crc = 0xfffffffful;
+            for (size_t i = begin; i < data.size(); ++i)
+                crc = table[(crc ^ data[i]) & 255] ^ (crc >> 8);
+            return crc ^ 0xfffffffful;
+        }
+
+        static void put32(std::vector<unsigned char>& out, unsigned long value)
+        {
+            for (int shift = 24; shift >= 0; shift -= 8)
+                out.push_back((value >> shift) & 255);
+        }
+
+        static void put_chunk(std::vector<unsigned char>& png,
+                              const char* type,
+                              const std::vector<unsigned char>& data)
+        {
+            put32(png, data.size());
+            size_t start = png.size();
+            png.insert(png.end(), type, type + 4);
+            png.insert(png.end(), data.begin(), data.end());
+            put32(png, crc32(png, start));
+        }
+    };
+}
@@ -0,0 +1,83 @@
+#include "texture_baker.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// bakes PNGs to files Engine::load_texture maps and uploads without decoding,
+// <png> <btex> for one, or any number of PNGs and a directory, where each
+// goes to its name with .btex for .png
+namespace
+{
+    int usage()
+    {
+        std::cerr << "usage: texture_baker [--format texels|bc1|bc3] "
+                     "[--mipmaps box|linear|none]\n"
+                     "                     [--threads <count>] "
+                     "<png> <btex> | <png>... <directory>"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    bool parse_number(const char* text, unsigned long& value)
+    {
+        char* end = nullptr;
+        value     = std::strtoul(text, &end, 10);
+        return *text != '\0' && *end == '\0';
+    }
+
+    bool is_directory(const std::string& path)
+    {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFDIR);
+    }
+}
+
+int main(int argn, char* args[])
+{
+    ge::bake_options opts;
+    int arg = 1;
+    for (; arg < argn && args[arg][0] == '-' && args[arg][1] == '-'; ++arg)
+    {
+        const std::string option = args[arg];
+        if (++arg == argn)
+            return usage();
+        const std::string value = args[arg];
+        if (option == "--format" &&
+            (value == "texels" || value == "bc1" || value == "bc3"))
+            opts.format = value;
+        else if (option == "--mipmaps" && value == "box")
+            opts.mipmaps = ge::mip_filter::box;
+        else if (option == "--mipmaps" && value == "linear")
+            opts.mipmaps = ge::mip_filter::linear;
+        else if (option == "--mipmaps" && value == "none")
+            opts.mipmaps = ge::mip_filter::none;
+        else if (option != "--threads" ||
+                 !parse_number(args[arg], opts.threads))
+            return usage();
+    }
+    if (argn - arg < 2)
+        return usage();
+
+    const std::string out = args[argn - 1];
+    const bool directory  = is_directory(out);
+    if (argn - arg > 2 && !directory)
+        return usage();
+    for (; arg < argn - 1; ++arg)
+    {
+        std::string path = out;
+        if (directory)
+        {
+            std::string name   = args[arg];
+            const size_t slash = name.find_last_of("/\\");
+            if (slash != std::string::npos)
+                name = name.substr(slash + 1);
+            name = name.substr(0, name.find_last_of('.'));
+            path = out + "/" + name + ".btex";
+        }
+        if (!ge::bake_texture(args[arg], path, opts))
+            return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
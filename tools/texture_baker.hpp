@@ -0,0 +1,118 @@
+#pragma once
+
+#include "../include/baked_texture.hpp"
+#include "../include/mipmap.hpp"
+#include "../include/picopng.hxx"
+#include "bc_encoder.hpp"
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// the baking of a PNG for tools/texture_baker, and for bench_startup, which
+// bakes the corpus it compares against
+namespace ge
+{
+    struct bake_options
+    {
+        // texels keeps the channels of the PNG, bc1 and bc3 compress
+        std::string format    = "texels";
+        mip_filter mipmaps    = mip_filter::box;
+        unsigned long threads = std::thread::hardware_concurrency();
+    };
+
+    // writes the PNG at png_path baked to path, false with a message on
+    // std::cerr if it can't be read or written
+    inline bool bake_texture(const std::string&  png_path,
+                             const std::string&  path,
+                             const bake_options& opts)
+    {
+        // bottom row first, as the engine uploads every texture
+        picopng::PNG decoder;
+        std::vector<unsigned char> png, image;
+        unsigned long width   = 0;
+        unsigned long height  = 0;
+        unsigned int channels = 4;
+        loadFile(png, png_path);
+        const unsigned char* in = png.empty() ? nullptr : &png.front();
+        const bool texels       = opts.format == "texels";
+        bool bottom_up          = true;
+        bool verify_checksums   = true;
+        int error               = 0;
+        if (texels)
+        {
+            error = decodePNGChannels(decoder,
+                                      image,
+                                      width,
+                                      height,
+                                      channels,
+                                      in,
+                                      png.size(),
+                                      bottom_up,
+                                      verify_checksums);
+        }
+        else
+        {
+            bool rgba32 = true;
+            error       = decodePNG(decoder,
+                              image,
+                              width,
+                              height,
+                              in,
+                              png.size(),
+                              rgba32,
+                              bottom_up,
+                              verify_checksums);
+        }
+        if (error != 0)
+        {
+            std::cerr << "Can't decode " << png_path << " (" << error << ")"
+                      << std::endl;
+            return false;
+        }
+
+        baked_format format = static_cast<baked_format>(channels);
+        if (opts.format == "bc1")
+            format = baked_format::bc1;
+        else if (opts.format == "bc3")
+            format = baked_format::bc3;
+        const unsigned int levels = opts.mipmaps == mip_filter::none
+                                        ? 1
+                                        : mip_levels(width, height);
+        build_mip_chain(image, width, height, channels, opts.mipmaps);
+
+        const baked_info info = baked_layout(width, height, format, levels);
+        std::vector<unsigned char> file = baked_header(info);
+        for (unsigned int level = 0; level < levels; ++level)
+        {
+            const unsigned char* pixels =
+                &image[mip_offset(width, height, channels, level)];
+            std::vector<unsigned char> blocks;
+            if (!texels)
+            {
+                blocks = encode_blocks(pixels,
+                                       mip_size(width, level),
+                                       mip_size(height, level),
+                                       format == baked_format::bc1
+                                           ? block_format::bc1
+                                           : block_format::bc3,
+                                       static_cast<unsigned int>(opts.threads));
+                pixels = &blocks.front();
+            }
+            file.resize(info.levels[level].offset, 0);
+            file.insert(file.end(),
+                        pixels,
+                        pixels + info.levels[level].bytes);
+        }
+
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&file.front()), file.size());
+        if (!out.good())
+        {
+            std::cerr << "Can't write " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+}
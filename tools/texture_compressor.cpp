@@ -0,0 +1,168 @@
+#include "../include/mipmap.hpp"
+#include "../include/picopng.hxx"
+#include "bc_encoder.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// compresses a PNG to a DDS file of BC1 blocks, for opaque images, or of BC3,
+// with its mipmap chain, which Engine::load_texture uploads as it is where
+// the driver has S3TC. Prints the size against RGBA and the PSNR of level 0
+namespace
+{
+    struct options
+    {
+        std::string format = "auto"; // bc1, bc3, or bc1 unless any alpha
+        ge::mip_filter mipmaps = ge::mip_filter::box;
+        unsigned long threads  = std::thread::hardware_concurrency();
+    };
+
+    int usage()
+    {
+        std::cerr << "usage: texture_compressor [--format auto|bc1|bc3] "
+                     "[--mipmaps box|linear|none]\n"
+                     "                          [--threads <count>] "
+                     "<png> <dds>"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    bool parse_number(const char* text, unsigned long& value)
+    {
+        char* end = nullptr;
+        value     = std::strtoul(text, &end, 10);
+        return *text != '\0' && *end == '\0';
+    }
+
+    // of RGBA against the decoded blocks, over the color channels and
+    // alpha for BC3
+    double psnr(const std::vector<unsigned char>& rgba,
+                const std::vector<unsigned char>& blocks,
+                unsigned long width,
+                unsigned long height,
+                ge::block_format format)
+    {
+        std::vector<unsigned char> decoded(rgba.size());
+        ge::decode_blocks(
+            &blocks.front(), width, height, format, &decoded.front());
+        const int channels = format == ge::block_format::bc3 ? 4 : 3;
+        double sum         = 0;
+        for (size_t i = 0; i < rgba.size(); ++i)
+        {
+            if (int(i % 4) >= channels)
+                continue;
+            const double e = double(rgba[i]) - decoded[i];
+            sum += e * e;
+        }
+        const double mse = sum / (double(width) * height * channels);
+        return mse == 0 ? 99 : 10 * std::log10(255.0 * 255.0 / mse);
+    }
+}
+
+int main(int argn, char* args[])
+{
+    options opts;
+    int arg = 1;
+    for (; arg < argn && args[arg][0] == '-' && args[arg][1] == '-'; ++arg)
+    {
+        const std::string option = args[arg];
+        if (++arg == argn)
+            return usage();
+        const std::string value = args[arg];
+        if (option == "--format" &&
+            (value == "auto" || value == "bc1" || value == "bc3"))
+            opts.format = value;
+        else if (option == "--mipmaps" && value == "box")
+            opts.mipmaps = ge::mip_filter::box;
+        else if (option == "--mipmaps" && value == "linear")
+            opts.mipmaps = ge::mip_filter::linear;
+        else if (option == "--mipmaps" && value == "none")
+            opts.mipmaps = ge::mip_filter::none;
+        else if (option != "--threads" ||
+                 !parse_number(args[arg], opts.threads))
+            return usage();
+    }
+    if (argn - arg != 2)
+        return usage();
+    const std::string png_path = args[arg];
+    const std::string dds_path = args[arg + 1];
+
+    // bottom row first, as the engine uploads every texture
+    picopng::PNG decoder;
+    std::vector<unsigned char> png, image;
+    unsigned long width = 0, height = 0;
+    loadFile(png, png_path);
+    bool rgba32    = true;
+    bool bottom_up = true;
+    int error      = decodePNG(decoder,
+                          image,
+                          width,
+                          height,
+                          png.empty() ? nullptr : &png.front(),
+                          png.size(),
+                          rgba32,
+                          bottom_up);
+    if (error != 0)
+    {
+        std::cerr << "Can't decode " << png_path << " (" << error << ")"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    bool opaque = true;
+    for (size_t i = 3; i < image.size() && opaque; i += 4)
+        opaque = image[i] == 255;
+    ge::dds_info info;
+    info.width  = width;
+    info.height = height;
+    info.format = opts.format == "bc3" || (opts.format == "auto" && !opaque)
+                      ? ge::block_format::bc3
+                      : ge::block_format::bc1;
+    info.levels = opts.mipmaps == ge::mip_filter::none
+                      ? 1
+                      : ge::mip_levels(width, height);
+    ge::build_mip_chain(image, width, height, 4, opts.mipmaps);
+
+    using clock                   = std::chrono::steady_clock;
+    const clock::time_point start = clock::now();
+    std::vector<unsigned char> dds = ge::dds_header(info);
+    std::vector<unsigned char> level0;
+    for (unsigned int level = 0; level < info.levels; ++level)
+    {
+        std::vector<unsigned char> blocks = ge::encode_blocks(
+            &image[ge::mip_offset(width, height, 4, level)],
+            ge::mip_size(width, level),
+            ge::mip_size(height, level),
+            info.format,
+            static_cast<unsigned int>(opts.threads));
+        dds.insert(dds.end(), blocks.begin(), blocks.end());
+        if (level == 0)
+            level0.swap(blocks);
+    }
+    const double seconds =
+        std::chrono::duration<double>(clock::now() - start).count();
+
+    std::ofstream file(dds_path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&dds.front()), dds.size());
+    if (!file.good())
+    {
+        std::cerr << "Can't write " << dds_path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    image.resize(size_t(width) * height * 4);
+    const size_t rgba_bytes = ge::mip_offset(width, height, 4, info.levels);
+    std::cout << dds_path << ": "
+              << (info.format == ge::block_format::bc1 ? "BC1" : "BC3")
+              << ", " << info.levels << " levels, " << dds.size()
+              << " bytes against " << rgba_bytes << " of RGBA, PSNR "
+              << psnr(image, level0, width, height, info.format) << " dB, "
+              << rgba_bytes / seconds / 1e6 << " MB/s of RGBA with "
+              << std::max(opts.threads, 1ul) << " threads" << std::endl;
+    return EXIT_SUCCESS;
+}